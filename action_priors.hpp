@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+// Move priors of every (agent, cell, action), derived once from the agents' distance-to-goal fields.
+// An action's weight is exp(distance gained / temperature); moves off the grid or into cells that cannot
+// reach the goal get no weight. Priors are quantized to one byte, so a 64x64 map costs 20 KB per agent.
+class ActionPriors
+{
+    int height = 0;
+    int width = 0;
+    int num_actions = 0;
+    std::vector<uint8_t> priors;
+public:
+    void init(const std::vector<std::vector<std::vector<double>>>& distances, const std::vector<std::pair<int, int>>& moves,
+              const int num_actions_, const double temperature)
+    {
+        height = distances.empty() ? 0 : static_cast<int>(distances[0].size());
+        width = height > 0 ? static_cast<int>(distances[0][0].size()) : 0;
+        num_actions = num_actions_;
+        priors.assign(distances.size() * height * width * num_actions, 0);
+        std::vector<double> weights(num_actions);
+        for(size_t agent_idx = 0; agent_idx < distances.size(); agent_idx++)
+        {
+            const auto& d = distances[agent_idx];
+            for(int i = 0; i < height; i++)
+            {
+                for(int j = 0; j < width; j++)
+                {
+                    if(d[i][j] >= 1000000)
+                        continue;
+                    double total(0);
+                    for(int k = 0; k < num_actions; k++)
+                    {
+                        const int ni = i + moves[k].first, nj = j + moves[k].second;
+                        weights[k] = 0;
+                        if(ni >= 0 && nj >= 0 && ni < height && nj < width && d[ni][nj] < 1000000)
+                            weights[k] = std::exp((d[i][j] - d[ni][nj]) / temperature);
+                        total += weights[k];
+                    }
+                    if(total <= 0)
+                        continue;
+                    uint8_t* cell = &priors[index(agent_idx, i, j)];
+                    for(int k = 0; k < num_actions; k++)
+                        cell[k] = static_cast<uint8_t>(std::lround(255 * weights[k] / total));
+                }
+            }
+        }
+    }
+
+    bool empty() const
+    {
+        return priors.empty();
+    }
+
+    size_t index(const size_t agent_idx, const int i, const int j) const
+    {
+        return ((agent_idx * height + i) * width + j) * num_actions;
+    }
+
+    // priors of all actions of agent_idx standing at pos, as num_actions consecutive bytes
+    const uint8_t* at(const size_t agent_idx, const std::pair<int, int> pos) const
+    {
+        return &priors[index(agent_idx, pos.first, pos.second)];
+    }
+};
@@ -0,0 +1,173 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+// CPU topology from sysfs and thread pinning. Pinning only decides where threads run; where memory is
+// allocated is left to the allocator and the kernel's first-touch policy.
+namespace Affinity
+{
+struct Cpu
+{
+    int id;
+    int node;
+    int package;
+    int core;
+};
+
+// parses sysfs cpu lists such as "0-3,8-11"
+inline std::vector<int> parse_list(const std::string& text)
+{
+    std::vector<int> result;
+    std::stringstream ss(text);
+    std::string range;
+    while (std::getline(ss, range, ','))
+    {
+        if (range.empty() || range == "\n")
+            continue;
+        const auto dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for (int i = first; i <= last; i++)
+            result.push_back(i);
+    }
+    return result;
+}
+
+inline std::string read_line(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+inline int read_int(const std::string& path, const int fallback)
+{
+    const auto line = read_line(path);
+    return line.empty() ? fallback : std::stoi(line);
+}
+
+// CPUs the calling thread may run on
+inline std::vector<int> allowed_cpus()
+{
+    std::vector<int> result;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int id = 0; id < CPU_SETSIZE; id++)
+            if (CPU_ISSET(id, &set))
+                result.push_back(id);
+    }
+#endif
+    return result;
+}
+
+// online CPUs that the calling thread may run on, so cpusets and taskset masks are respected
+inline std::vector<Cpu> online_cpus()
+{
+    std::vector<Cpu> cpus;
+    const auto allowed = allowed_cpus();
+    for (const int id: parse_list(read_line("/sys/devices/system/cpu/online")))
+    {
+        if (!allowed.empty() && std::find(allowed.begin(), allowed.end(), id) == allowed.end())
+            continue;
+        const std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+        cpus.push_back({id, 0, read_int(topology + "physical_package_id", 0), read_int(topology + "core_id", id)});
+    }
+    for (const int node: parse_list(read_line("/sys/devices/system/node/online")))
+    {
+        for (const int id: parse_list(read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")))
+        {
+            for (auto& cpu: cpus)
+                if (cpu.id == id)
+                    cpu.node = node;
+        }
+    }
+    return cpus;
+}
+
+// CPU of each of num_threads workers. "compact" fills the hardware threads of one core, then of one
+// node, before moving on; "scatter" deals workers round-robin over the nodes and over cores within a node.
+inline std::vector<Cpu> placement(const std::string& policy, const int num_threads, std::vector<Cpu> cpus = online_cpus())
+{
+    std::vector<Cpu> result;
+    if (cpus.empty() || num_threads <= 0)
+        return result;
+    std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b)
+    {
+        return std::tie(a.node, a.package, a.core, a.id) < std::tie(b.node, b.package, b.core, b.id);
+    });
+    if (policy == "scatter")
+    {
+        // within a node, first hardware threads of all cores come before their siblings
+        std::vector<std::vector<Cpu>> per_node(cpus.back().node + 1);
+        for (const auto& cpu: cpus)
+            per_node[cpu.node].push_back(cpu);
+        for (auto& node_cpus: per_node)
+        {
+            std::vector<std::pair<int, Cpu>> ranked;
+            for (size_t i = 0; i < node_cpus.size(); i++)
+            {
+                int sibling = 0;
+                for (size_t j = 0; j < i; j++)
+                    if (node_cpus[j].package == node_cpus[i].package && node_cpus[j].core == node_cpus[i].core)
+                        sibling++;
+                ranked.emplace_back(sibling, node_cpus[i]);
+            }
+            std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+            for (size_t i = 0; i < ranked.size(); i++)
+                node_cpus[i] = ranked[i].second;
+        }
+        cpus.clear();
+        size_t longest = 0;
+        for (const auto& node_cpus: per_node)
+            longest = std::max(longest, node_cpus.size());
+        for (size_t k = 0; k < longest; k++)
+            for (const auto& node_cpus: per_node)
+                if (k < node_cpus.size())
+                    cpus.push_back(node_cpus[k]);
+    }
+    for (int i = 0; i < num_threads; i++)
+        result.push_back(cpus[i % cpus.size()]);
+    return result;
+}
+
+inline bool pin_current_thread(const Cpu& cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu.id, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+// undoes pin_current_thread(), the thread may run on any of cpus again
+inline bool unpin_current_thread(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+    if (cpus.empty())
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int id: cpus)
+        CPU_SET(id, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+}
@@ -0,0 +1,111 @@
+#include "mcts.cpp"
+#include "map_generator.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+// Runs full episodes on generated maps without Python and reports search throughput, act() latency,
+// peak memory and success. Usage:
+//   benchmark [--size N] [--density D] [--agents N] [--seed S] [--episodes N] [--max-steps N]
+//             [--obs-radius R] [--threads N] [--<config field> value ...]
+// Any Config field can be set by name, e.g. --num_expansions 200 --simulation_type replan --batch_size 4.
+
+double percentile(std::vector<double> values, const double p)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    const size_t k = std::min(values.size() - 1, static_cast<size_t>(p / 100.0 * values.size()));
+    return values[k];
+}
+
+int main(int argc, char* argv[])
+{
+    MapSpec spec;
+    int episodes(1), max_steps(64), obs_radius(5), threads(0);
+    Config cfg;
+    cfg.render = false;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string key = std::string(argv[i]).substr(2);
+        const std::string value = argv[i + 1];
+        if (key == "size") spec.size = std::stoi(value);
+        else if (key == "density") spec.density = std::stod(value);
+        else if (key == "agents") spec.num_agents = std::stoi(value);
+        else if (key == "seed") spec.seed = std::stoi(value);
+        else if (key == "episodes") episodes = std::stoi(value);
+        else if (key == "max-steps") max_steps = std::stoi(value);
+        else if (key == "obs-radius") obs_radius = std::stoi(value);
+        else if (key == "threads") threads = std::stoi(value);
+        else if (config_fields().count(key)) config_fields().at(key).set(cfg, value);
+        else
+        {
+            std::cerr << "unknown option --" << key << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<double> latencies_ms;
+    uint64_t expanded(0), rollouts(0);
+    int solved(0), total_steps(0), reached_agents(0), total_agents(0);
+    double search_seconds(0);
+    for (int episode = 0; episode < episodes; episode++)
+    {
+        MapSpec episode_spec = spec;
+        episode_spec.seed = spec.seed + episode;
+        const auto map = generate_map(episode_spec);
+        Environment env;
+        env.create_grid(spec.size, spec.size);
+        for (int i = 0; i < spec.size; i++)
+            for (int j = 0; j < spec.size; j++)
+                if (map.obstacles[i][j])
+                    env.add_obstacle(i, j);
+        for (size_t k = 0; k < map.starts.size(); k++)
+            env.add_agent(map.starts[k].first, map.starts[k].second, map.goals[k].first, map.goals[k].second);
+        env.set_seed(episode_spec.seed);
+
+        // rollouts are seeded from the episode seed as well, so runs repeat
+        Config episode_cfg = cfg;
+        episode_cfg.seed = episode_spec.seed;
+        MonteCarloTreeSearch mcts(threads);
+        mcts.set_config(episode_cfg);
+        mcts.set_env(env, obs_radius);
+        int steps(0);
+        while (!env.all_done() && steps < max_steps)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const auto actions = mcts.act();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            latencies_ms.push_back(seconds * 1000);
+            search_seconds += seconds;
+            env.step(actions);
+            steps++;
+        }
+        expanded += mcts.get_num_expanded();
+        rollouts += mcts.get_num_rollouts();
+        total_steps += steps;
+        solved += env.all_done();
+        total_agents += env.get_num_agents();
+        for (size_t k = 0; k < env.get_num_agents(); k++)
+            reached_agents += env.reached_goal(k);
+    }
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "episodes: " << episodes << "\n";
+    std::cout << "steps: " << total_steps << "\n";
+    std::cout << "expansions/s: " << (search_seconds > 0 ? expanded / search_seconds : 0) << "\n";
+    std::cout << "rollouts/s: " << (search_seconds > 0 ? rollouts / search_seconds : 0) << "\n";
+    std::cout << "latency_ms p50: " << percentile(latencies_ms, 50) << " p90: " << percentile(latencies_ms, 90)
+              << " p99: " << percentile(latencies_ms, 99) << " max: " << percentile(latencies_ms, 100) << "\n";
+    std::cout << "peak_rss_mb: " << usage.ru_maxrss / 1024.0 << "\n";
+    std::cout << "CSR: " << static_cast<double>(solved) / std::max(episodes, 1) << "\n";
+    std::cout << "ISR: " << static_cast<double>(reached_agents) / std::max(total_agents, 1) << "\n";
+    std::cout << "ep_length: " << static_cast<double>(total_steps) / std::max(episodes, 1) << "\n";
+    return 0;
+}
@@ -2,7 +2,12 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <sstream>
 #include <string>
+#include <type_traits>
 namespace py = pybind11;
 struct Config
 {
@@ -19,8 +24,135 @@ struct Config
     bool render = true;
     double heuristic_coef = 0;
     std::string simulation_type = "random";
+    bool parallel_replan = false;
+    bool use_plan_cache = false;
+    int stagnation_steps = 0;
+    bool pipelined_batch = false;
+    bool work_stealing = false;
+    bool joint_search = false;
+    bool decoupled_search = false;
+    bool collapse_finished_agents = false;
+    bool triage_forced_moves = false;
+    int step_budget = 0;
+    int ponder_expansions = 0;
+    bool early_stop = false;
+    double early_stop_confidence = 0;
+    bool use_puct = false;
+    double puct_c = 1.0;
+    double prior_temperature = 1.0;
+    bool use_rave = false;
+    double rave_k = 100;
+    int num_processes = 1;
+    std::string affinity = "none";
+    bool collect_stats = false;
+    // how long the coordinator waits for worker processes after its own search before it restarts them
+    int worker_timeout_ms = 1000;
+    // -1 seeds every rollout from the clock; otherwise rollout seeds derive from it, which makes runs with
+    // sequential search (batch_size 1, one tree, one simulation per leaf) reproducible
+    int seed = -1;
 };
 
+// Reads and writes one field as text, for command lines and for passing a config to worker processes
+struct ConfigField
+{
+    std::function<void(Config&, const std::string&)> set;
+    std::function<std::string(const Config&)> get;
+};
+
+template<typename T>
+ConfigField config_field(T Config::* field)
+{
+    ConfigField result;
+    result.set = [field](Config& cfg, const std::string& text)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+            cfg.*field = (text == "1" || text == "true" || text == "True");
+        else if constexpr (std::is_same_v<T, int>)
+            cfg.*field = std::stoi(text);
+        else if constexpr (std::is_same_v<T, double>)
+            cfg.*field = std::stod(text);
+        else
+            cfg.*field = text;
+    };
+    result.get = [field](const Config& cfg)
+    {
+        std::ostringstream out;
+        out << std::setprecision(17) << cfg.*field;
+        return out.str();
+    };
+    return result;
+}
+
+inline const std::map<std::string, ConfigField>& config_fields()
+{
+    static const std::map<std::string, ConfigField> fields = {
+        {"gamma", config_field(&Config::gamma)},
+        {"num_actions", config_field(&Config::num_actions)},
+        {"num_expansions", config_field(&Config::num_expansions)},
+        {"uct_c", config_field(&Config::uct_c)},
+        {"steps_limit", config_field(&Config::steps_limit)},
+        {"multi_simulations", config_field(&Config::multi_simulations)},
+        {"use_move_limits", config_field(&Config::use_move_limits)},
+        {"agents_as_obstacles", config_field(&Config::agents_as_obstacles)},
+        {"batch_size", config_field(&Config::batch_size)},
+        {"num_parallel_trees", config_field(&Config::num_parallel_trees)},
+        {"render", config_field(&Config::render)},
+        {"heuristic_coef", config_field(&Config::heuristic_coef)},
+        {"simulation_type", config_field(&Config::simulation_type)},
+        {"parallel_replan", config_field(&Config::parallel_replan)},
+        {"use_plan_cache", config_field(&Config::use_plan_cache)},
+        {"stagnation_steps", config_field(&Config::stagnation_steps)},
+        {"pipelined_batch", config_field(&Config::pipelined_batch)},
+        {"work_stealing", config_field(&Config::work_stealing)},
+        {"joint_search", config_field(&Config::joint_search)},
+        {"decoupled_search", config_field(&Config::decoupled_search)},
+        {"collapse_finished_agents", config_field(&Config::collapse_finished_agents)},
+        {"triage_forced_moves", config_field(&Config::triage_forced_moves)},
+        {"step_budget", config_field(&Config::step_budget)},
+        {"ponder_expansions", config_field(&Config::ponder_expansions)},
+        {"early_stop", config_field(&Config::early_stop)},
+        {"early_stop_confidence", config_field(&Config::early_stop_confidence)},
+        {"use_puct", config_field(&Config::use_puct)},
+        {"puct_c", config_field(&Config::puct_c)},
+        {"prior_temperature", config_field(&Config::prior_temperature)},
+        {"use_rave", config_field(&Config::use_rave)},
+        {"rave_k", config_field(&Config::rave_k)},
+        {"num_processes", config_field(&Config::num_processes)},
+        {"affinity", config_field(&Config::affinity)},
+        {"collect_stats", config_field(&Config::collect_stats)},
+        {"worker_timeout_ms", config_field(&Config::worker_timeout_ms)},
+        {"seed", config_field(&Config::seed)},
+    };
+    return fields;
+}
+
+// one "name=value" line per field
+inline std::string config_to_text(const Config& cfg)
+{
+    std::string text;
+    for(const auto& field: config_fields())
+    {
+        text += field.first + "=" + field.second.get(cfg) + "\n";
+    }
+    return text;
+}
+
+inline Config config_from_text(const std::string& text)
+{
+    Config cfg;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        const size_t separator = line.find('=');
+        if (separator != std::string::npos && config_fields().count(line.substr(0, separator)))
+        {
+            config_fields().at(line.substr(0, separator)).set(cfg, line.substr(separator + 1));
+        }
+    }
+    return cfg;
+}
+
 PYBIND11_MODULE(config, m) {
     py::class_<Config>(m, "Config")
         .def(py::init<>())
@@ -37,6 +169,29 @@ PYBIND11_MODULE(config, m) {
         .def_readwrite("render", &Config::render)
         .def_readwrite("heuristic_coef", &Config::heuristic_coef)
         .def_readwrite("simulation_type", &Config::simulation_type)
+        .def_readwrite("parallel_replan", &Config::parallel_replan)
+        .def_readwrite("use_plan_cache", &Config::use_plan_cache)
+        .def_readwrite("stagnation_steps", &Config::stagnation_steps)
+        .def_readwrite("pipelined_batch", &Config::pipelined_batch)
+        .def_readwrite("work_stealing", &Config::work_stealing)
+        .def_readwrite("joint_search", &Config::joint_search)
+        .def_readwrite("decoupled_search", &Config::decoupled_search)
+        .def_readwrite("collapse_finished_agents", &Config::collapse_finished_agents)
+        .def_readwrite("triage_forced_moves", &Config::triage_forced_moves)
+        .def_readwrite("step_budget", &Config::step_budget)
+        .def_readwrite("ponder_expansions", &Config::ponder_expansions)
+        .def_readwrite("early_stop", &Config::early_stop)
+        .def_readwrite("early_stop_confidence", &Config::early_stop_confidence)
+        .def_readwrite("use_puct", &Config::use_puct)
+        .def_readwrite("puct_c", &Config::puct_c)
+        .def_readwrite("prior_temperature", &Config::prior_temperature)
+        .def_readwrite("use_rave", &Config::use_rave)
+        .def_readwrite("rave_k", &Config::rave_k)
+        .def_readwrite("num_processes", &Config::num_processes)
+        .def_readwrite("affinity", &Config::affinity)
+        .def_readwrite("collect_stats", &Config::collect_stats)
+        .def_readwrite("worker_timeout_ms", &Config::worker_timeout_ms)
+        .def_readwrite("seed", &Config::seed)
         ;
 }
 
@@ -2,10 +2,12 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
+#include <pybind11/numpy.h>
 #include <vector>
 #include <iostream>
 #include <random>
 #include <chrono>
+#include <stdexcept>
 #define OBSTACLE 1
 #define TRAVERSABLE 0
 namespace py = pybind11;
@@ -15,6 +17,7 @@ class Environment
     std::vector<std::vector<int>> made_actions;
     std::vector<bool> reached;
     std::default_random_engine engine;
+    uint64_t seed_salt = 0;
 public:
     size_t num_agents;
     std::vector<std::pair<int, int>> moves = {{0,0}, {-1, 0}, {1,0},{0,-1},{0,1}};
@@ -29,17 +32,23 @@ public:
     void set_seed(const int seed)
     {
         if(seed < 0)
-            engine.seed(std::chrono::system_clock::now().time_since_epoch().count());
+            engine.seed(std::chrono::system_clock::now().time_since_epoch().count() ^ seed_salt);
         else
             engine.seed(seed);
     }
 
     void reset_seed()
     {
-        engine.seed(std::chrono::system_clock::now().time_since_epoch().count());
+        engine.seed(std::chrono::system_clock::now().time_since_epoch().count() ^ seed_salt);
     }
 
-    size_t get_num_agents()
+    // mixed into clock-based seeds, so that copies seeded at the same moment in different processes diverge
+    void set_seed_salt(const uint64_t salt)
+    {
+        seed_salt = salt;
+    }
+
+    size_t get_num_agents() const
     {
         return num_agents;
     }
@@ -62,6 +71,29 @@ public:
         grid[i][j] = OBSTACLE;
     }
 
+    // whole map from a (height, width) array in one call, every non-zero cell is an obstacle
+    void load_grid(const py::array_t<int, py::array::c_style | py::array::forcecast>& obstacles)
+    {
+        const auto cells = obstacles.unchecked<2>();
+        create_grid(cells.shape(0), cells.shape(1));
+        for(py::ssize_t i = 0; i < cells.shape(0); i++)
+            for(py::ssize_t j = 0; j < cells.shape(1); j++)
+                if(cells(i, j) != 0)
+                    grid[i][j] = OBSTACLE;
+    }
+
+    // all agents from (num_agents, 2) arrays of start and goal cells
+    void load_agents(const py::array_t<int, py::array::c_style | py::array::forcecast>& starts,
+                     const py::array_t<int, py::array::c_style | py::array::forcecast>& finishes)
+    {
+        const auto s = starts.unchecked<2>();
+        const auto f = finishes.unchecked<2>();
+        if(s.shape(0) != f.shape(0) || s.shape(1) != 2 || f.shape(1) != 2)
+            throw std::invalid_argument("starts and finishes must both have shape (num_agents, 2)");
+        for(py::ssize_t k = 0; k < s.shape(0); k++)
+            add_agent(s(k, 0), s(k, 1), f(k, 0), f(k, 1));
+    }
+
     bool reached_goal(size_t i) const
     {
         if(i >= 0 && i < num_agents)
@@ -156,6 +188,32 @@ public:
         return actions;
     }
 
+    // takes over positions and goal flags of another copy of the same map and agents
+    void copy_state(const Environment& other)
+    {
+        cur_positions = other.cur_positions;
+        reached = other.reached;
+    }
+
+    // moves the agents to positions observed outside of this copy, e.g. after a transition it did not predict
+    void set_positions(const std::vector<std::pair<int, int>>& positions)
+    {
+        cur_positions = positions;
+        for(size_t i = 0; i < num_agents; i++)
+            reached[i] = (cur_positions[i] == goals[i]);
+    }
+
+    // true if no agent changed its position during the last step
+    bool last_step_idle() const
+    {
+        if (made_actions.empty())
+            return false;
+        for(const auto a: made_actions.back())
+            if (a != 0)
+                return false;
+        return true;
+    }
+
     bool all_done()
     {
         return static_cast<int>(num_agents) == std::accumulate(reached.begin(), reached.end(), 0);
@@ -222,6 +280,7 @@ public:
         made_actions = orig.made_actions;
         reached = orig.reached;
         engine = orig.engine;
+        seed_salt = orig.seed_salt;
         reset_seed();
     }
 };
@@ -238,6 +297,8 @@ PYBIND11_MODULE(environment, m) {
             .def("create_grid", &Environment::create_grid)
             .def("add_obstacle", &Environment::add_obstacle)
             .def("add_agent", &Environment::add_agent)
+            .def("load_grid", &Environment::load_grid)
+            .def("load_agents", &Environment::load_agents)
             .def("render", &Environment::render)
             .def("get_num_agents", &Environment::get_num_agents)
             .def("reached_goal", &Environment::reached_goal)
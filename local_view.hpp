@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include <list>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+// Bit-packed copy of the obstacle grid plus, for every agent, a mask of the cells it has already observed.
+// Each query only reports obstacles that enter the agent's window for the first time, so the planners'
+// obstacle sets are extended incrementally instead of being refilled with the whole window every step.
+class LocalView
+{
+    int height = 0;
+    int width = 0;
+    int words_per_row = 0;
+    std::vector<uint64_t> obstacles;
+    std::vector<std::vector<uint64_t>> seen;
+
+    static uint64_t bits_between(const int lo, const int hi)
+    {
+        return (~uint64_t(0) >> (63 - hi)) & (~uint64_t(0) << lo);
+    }
+public:
+    void init(const std::vector<std::vector<int>>& grid, const int num_agents)
+    {
+        height = static_cast<int>(grid.size());
+        width = height > 0 ? static_cast<int>(grid[0].size()) : 0;
+        words_per_row = (width + 63) / 64;
+        obstacles.assign(height * words_per_row, 0);
+        for(int i = 0; i < height; i++)
+            for(int j = 0; j < width; j++)
+                if(grid[i][j] == 1)
+                    obstacles[i * words_per_row + j / 64] |= uint64_t(1) << (j % 64);
+        seen.assign(num_agents, {});
+    }
+
+    // Appends obstacles of the (2r+1)x(2r+1) window around pos that agent_idx has not seen yet.
+    // Coordinates are relative to the window corner (pos - r), cells outside the grid are skipped.
+    void new_obstacles(const int agent_idx, const std::pair<int, int> pos, const int r, std::list<std::pair<int, int>>& result)
+    {
+        auto& agent_seen = seen[agent_idx];
+        if(agent_seen.empty())
+            agent_seen.assign(obstacles.size(), 0);
+        const int corner_i = pos.first - r, corner_j = pos.second - r;
+        const int i0 = std::max(0, corner_i), i1 = std::min(height - 1, pos.first + r);
+        const int j0 = std::max(0, corner_j), j1 = std::min(width - 1, pos.second + r);
+        if(j0 > j1)
+            return;
+        for(int i = i0; i <= i1; i++)
+        {
+            for(int w = j0 / 64; w <= j1 / 64; w++)
+            {
+                const int idx = i * words_per_row + w;
+                const uint64_t window = bits_between(std::max(j0 - w * 64, 0), std::min(j1 - w * 64, 63));
+                uint64_t fresh = window & ~agent_seen[idx];
+                agent_seen[idx] |= fresh;
+                fresh &= obstacles[idx];
+                while(fresh)
+                {
+                    const int j = w * 64 + __builtin_ctzll(fresh);
+                    result.emplace_back(i - corner_i, j - corner_j);
+                    fresh &= fresh - 1;
+                }
+            }
+        }
+    }
+};
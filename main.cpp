@@ -4,18 +4,15 @@ int main(int argc, char* argv[])
 {
     auto mcts = MonteCarloTreeSearch();
     auto env = Environment();
-    env.add_agent(0, 0, 1, 0);
     env.create_grid(2, 2);
     env.add_obstacle(0, 1);
+    env.add_agent(0, 0, 1, 0);
     env.render();
     auto config = Config();
     mcts.set_config(config);
-    mcts.set_env(env);
-    while(true) {
-        std::cout<<"in\n";
-        mcts.act();
-        std::cout<<"step\n";
-        if(mcts.env.all_done())
-            break;
+    mcts.set_env(env, 5);
+    while(!env.all_done()) {
+        env.step(mcts.act());
+        env.render();
     }
-}
\ No newline at end of file
+}
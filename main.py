@@ -47,14 +47,8 @@ def main():
     replan = RePlan()
     replan.init(env.get_num_agents(),gc.obs_radius,True,0.2,True, 10000000, -1, False)
     cpp_env = Environment()
-    for i in range(env.get_num_agents()):
-        cpp_env.add_agent(env.grid.positions_xy[i][0], env.grid.positions_xy[i][1],
-                env.grid.finishes_xy[i][0], env.grid.finishes_xy[i][1])
-        cpp_env.create_grid(len(env.grid.obstacles),len(env.grid.obstacles[0]))
-    for i in range(len(env.grid.obstacles)):
-        for j in range(len(env.grid.obstacles[0])):
-            if env.grid.obstacles[i][j]:
-                cpp_env.add_obstacle(i, j)
+    cpp_env.load_grid(np.asarray(env.grid.obstacles))
+    cpp_env.load_agents(np.asarray(env.grid.positions_xy), np.asarray(env.grid.finishes_xy))
     mcts.set_env(cpp_env, gc.obs_radius)
     replan.set_env(cpp_env)
     done = [False]
@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Random maps in the style of pogema: every cell is an obstacle with probability density, and each agent's
+// start and goal are distinct free cells of one connected component, so every goal is reachable.
+struct MapSpec
+{
+    int size = 8;
+    double density = 0.3;
+    int num_agents = 4;
+    int seed = 0;
+};
+
+struct GeneratedMap
+{
+    std::vector<std::vector<int>> obstacles;
+    std::vector<std::pair<int, int>> starts;
+    std::vector<std::pair<int, int>> goals;
+};
+
+inline GeneratedMap generate_map(const MapSpec& spec)
+{
+    std::mt19937 rng(spec.seed);
+    std::bernoulli_distribution obstacle(spec.density);
+    GeneratedMap map;
+    map.obstacles.assign(spec.size, std::vector<int>(spec.size, 0));
+    for (auto& row: map.obstacles)
+        for (auto& cell: row)
+            cell = obstacle(rng) ? 1 : 0;
+
+    // label connected components of free cells
+    std::vector<std::vector<int>> component(spec.size, std::vector<int>(spec.size, -1));
+    std::vector<std::vector<std::pair<int, int>>> components;
+    const std::pair<int, int> moves[4] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    for (int i = 0; i < spec.size; i++)
+    {
+        for (int j = 0; j < spec.size; j++)
+        {
+            if (map.obstacles[i][j] || component[i][j] >= 0)
+                continue;
+            components.emplace_back();
+            std::deque<std::pair<int, int>> queue = {{i, j}};
+            component[i][j] = components.size() - 1;
+            while (!queue.empty())
+            {
+                const auto cell = queue.front();
+                queue.pop_front();
+                components.back().push_back(cell);
+                for (const auto& move: moves)
+                {
+                    const int ni = cell.first + move.first, nj = cell.second + move.second;
+                    if (ni < 0 || nj < 0 || ni >= spec.size || nj >= spec.size || map.obstacles[ni][nj] || component[ni][nj] >= 0)
+                        continue;
+                    component[ni][nj] = component[i][j];
+                    queue.emplace_back(ni, nj);
+                }
+            }
+        }
+    }
+
+    // agents go to components with at least two unused cells, larger components first
+    std::sort(components.begin(), components.end(), [](const auto& a, const auto& b) { return a.size() > b.size(); });
+    for (auto& cells: components)
+        std::shuffle(cells.begin(), cells.end(), rng);
+    std::vector<size_t> used(components.size(), 0);
+    for (int agent = 0; agent < spec.num_agents; agent++)
+    {
+        std::vector<size_t> candidates;
+        for (size_t c = 0; c < components.size(); c++)
+            if (components[c].size() - used[c] >= 2)
+                candidates.push_back(c);
+        if (candidates.empty())
+            break;
+        std::vector<double> weights;
+        for (const auto c: candidates)
+            weights.push_back(components[c].size() - used[c]);
+        const size_t c = candidates[std::discrete_distribution<size_t>(weights.begin(), weights.end())(rng)];
+        map.starts.push_back(components[c][used[c]++]);
+        map.goals.push_back(components[c][used[c]++]);
+    }
+    return map;
+}
@@ -3,14 +3,21 @@
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 #include "BS_thread_pool.hpp"
+#include "work_stealing_pool.hpp"
 #include "mcts.hpp"
+#include "uct_kernel.hpp"
 #include <mutex>
 #include <deque>
 #include <utility>
 #include <functional>
 #include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
 
 std::mutex insert_mutex;
+// set on threads of the search pool, where fork_join() must not wait for the pool
+thread_local bool in_pool_task = false;
 namespace py = pybind11;
 
 template<typename T>
@@ -21,20 +28,129 @@ void pop_front(std::vector<T>& vec)
 }
 
 
-MonteCarloTreeSearch::MonteCarloTreeSearch()
+MonteCarloTreeSearch::MonteCarloTreeSearch(const int num_threads)
+    : pool_size(num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency())),
+      process_cpus(Affinity::allowed_cpus())
 {}
 
+MonteCarloTreeSearch::~MonteCarloTreeSearch()
+{
+    for(auto& pending: async_acts)
+    {
+        pending.wait();
+    }
+    stop_pondering();
+    if (ponder_thread.joinable())
+    {
+        {
+            const std::lock_guard<std::mutex> lock(ponder_mutex);
+            ponder_exit = true;
+        }
+        ponder_cv.notify_all();
+        ponder_thread.join();
+    }
+}
+
+template<typename F>
+void MonteCarloTreeSearch::fork_join(const int num_tasks, F&& f)
+{
+    // time from submission until a worker picks the task up
+    const uint64_t queued = cfg.collect_stats ? SearchCounters::now() : 0;
+    auto run = [this, &f, queued](const int i)
+    {
+        if (queued != 0)
+        {
+            counters.pool_wait_ns += SearchCounters::now() - queued;
+        }
+        TRACE_SPAN("task");
+        f(i);
+    };
+    if (cfg.work_stealing)
+    {
+        WS::pool& ws = stealing_pool();
+        struct Indexed
+        {
+            decltype(run)* f;
+            int i;
+            void operator()() { (*f)(i); }
+        };
+        std::vector<Indexed> tasks;
+        tasks.reserve(num_tasks);
+        WS::task_group group;
+        for(int i = 0; i < num_tasks; i++)
+        {
+            tasks.push_back({&run, i});
+            ws.spawn(group, tasks.back());
+        }
+        ws.wait(group);
+    }
+    else if (in_pool_task)
+    {
+        // all pool threads may be waiting in fork_join() already, e.g. parallel trees with multi_simulations
+        for(int i = 0; i < num_tasks; i++)
+        {
+            run(i);
+        }
+    }
+    else
+    {
+        BS::thread_pool& threads = thread_pool();
+        std::vector<std::future<void>> futures;
+        for(int i = 0; i < num_tasks; i++)
+        {
+            futures.push_back(threads.submit([&run, i]{ in_pool_task = true; run(i); }));
+        }
+        for(auto& future: futures)
+        {
+            future.get();
+        }
+    }
+}
+
+// list links and child vectors included, RAVE arrays counted when RAVE is on
+uint64_t MonteCarloTreeSearch::node_footprint(const int num_actions) const
+{
+    uint64_t bytes = sizeof(Node) + 2 * sizeof(void*) + num_actions * sizeof(Node*) + (num_actions + 7) / 8;
+    if (cfg.use_rave)
+        bytes += num_actions * (sizeof(uint32_t) + sizeof(double));
+    return bytes;
+}
+
 Node* MonteCarloTreeSearch::safe_insert_node(Node* n, const int action, const double score, const int num_actions, const int next_agent_idx)
 {
-    const std::lock_guard<std::mutex> lock(insert_mutex);
-    all_nodes.emplace_back(n, action, score, num_actions, next_agent_idx);
-    return &all_nodes.back();
+    num_nodes.fetch_add(1, std::memory_order_relaxed);
+    node_bytes.fetch_add(node_footprint(num_actions), std::memory_order_relaxed);
+    if (cfg.collect_stats)
+    {
+        const uint64_t start = SearchCounters::now();
+        all_nodes.mutex.lock();
+        counters.insert_wait_ns += SearchCounters::now() - start;
+    }
+    else
+    {
+        all_nodes.mutex.lock();
+    }
+    const std::lock_guard<std::mutex> lock(all_nodes.mutex, std::adopt_lock);
+    all_nodes.nodes.emplace_back(n, action, score, num_actions, next_agent_idx);
+    return &all_nodes.nodes.back();
 }
 
 double MonteCarloTreeSearch::single_simulation(const int process_num)
 {
+    TRACE_SPAN("single_simulation");
     // std::chrono::steady_clock::time_point begin = // std::chrono::steady_clock::now();
-    penvs[process_num].reset_seed();
+    num_rollouts.fetch_add(1, std::memory_order_relaxed);
+    // with a fixed seed, rollouts take reproducible seeds in the order they start
+    int rollout_seed(-1);
+    if (cfg.seed >= 0)
+    {
+        rollout_seed = static_cast<int>(mix_hash(static_cast<uint64_t>(cfg.seed) ^ mix_hash(seeded_rollouts.fetch_add(1, std::memory_order_relaxed))) & 0x7fffffff);
+        penvs[process_num].set_seed(rollout_seed);
+    }
+    else
+    {
+        penvs[process_num].reset_seed();
+    }
     double score(0);
     double g(1), reward(0);
     int num_steps(0);
@@ -42,9 +158,19 @@ double MonteCarloTreeSearch::single_simulation(const int process_num)
     if (cfg.simulation_type == "replan")
     {
         replan = RePlan();
-        replan.init(penvs[process_num].get_num_agents(), obs_radius, true, 0.2, true, 10000000, -1, false);
+        replan.init(penvs[process_num].get_num_agents(), obs_radius, true, 0.2, true, 10000000, rollout_seed, false);
         replan.set_env(penvs[process_num]);
+        // only safe when rollouts run on the calling thread, pool workers must not block on the pool itself
+        if (cfg.parallel_replan && cfg.batch_size <= 1 && cfg.num_parallel_trees <= 1 && cfg.multi_simulations <= 1)
+        {
+            replan.set_thread_pool(&thread_pool());
+        }
+        if (cfg.use_plan_cache)
+        {
+            replan.set_plan_cache(&plan_cache);
+        }
     }
+    int idle_steps(0);
     while(!penvs[process_num].all_done() && num_steps < cfg.steps_limit)
     {
         std::vector<int> actions_tbd;
@@ -57,15 +183,33 @@ double MonteCarloTreeSearch::single_simulation(const int process_num)
         {
             actions_tbd = penvs[process_num].sample_actions(cfg.num_actions, cfg.use_move_limits, cfg.agents_as_obstacles);
         }
+        if (rave_enabled())
+        {
+            // agents waiting on their goal did not choose anything
+            for(size_t i = 0; i < actions_tbd.size(); i++)
+                if (!penvs[process_num].reached_goal(i))
+                    amaf_moves[process_num][i].push_back({penvs[process_num].cur_positions[i], actions_tbd[i]});
+        }
         reward = penvs[process_num].step(actions_tbd);
         num_steps++;
         score += reward*g;
         g *= cfg.gamma;
+        // a stuck rollout would only collect zero rewards until steps_limit
+        if (cfg.stagnation_steps > 0)
+        {
+            idle_steps = penvs[process_num].last_step_idle() ? idle_steps + 1 : 0;
+            if (idle_steps >= cfg.stagnation_steps)
+                break;
+        }
     }
     for (int i = 0; i < num_steps; i++)
     {
         penvs[process_num].step_back();
     }
+    if (cfg.collect_stats)
+    {
+        counters.add_rollout_length(num_steps);
+    }
     // std::chrono::steady_clock::time_point end = // std::chrono::steady_clock::now();
     // std::cout << "simulation = " << // std::chrono::duration_cast<// std::chrono::microseconds>(end - begin).count() << "[µs]" << std::endl;
     return score;
@@ -76,14 +220,29 @@ double MonteCarloTreeSearch::simulation(const int process_num = 0)
     double score(0);
     if (cfg.multi_simulations > 1)
     {
-        std::vector<std::future<double>> futures;
+        // every caller owns a block of rollout environments, so nested parallel modes never share one
+        const int first_env = num_search_envs + process_num * cfg.multi_simulations;
         for(int thread = 0; thread < cfg.multi_simulations; thread++)
         {
-            futures.push_back(pool.submit(&MonteCarloTreeSearch::single_simulation, this, thread));
+            penvs[first_env + thread].copy_state(penvs[process_num]);
         }
-        for(int thread = 0; thread < cfg.multi_simulations; thread++)
+        std::vector<double> scores(cfg.multi_simulations);
+        fork_join(cfg.multi_simulations, [this, &scores, first_env](const int thread)
         {
-            score += futures[thread].get();
+            scores[thread] = single_simulation(first_env + thread);
+        });
+        score = std::accumulate(scores.begin(), scores.end(), 0.0);
+        if (rave_enabled())
+        {
+            for(int thread = 0; thread < cfg.multi_simulations; thread++)
+            {
+                for(size_t i = 0; i < amaf_moves[process_num].size(); i++)
+                {
+                    auto& moves = amaf_moves[first_env + thread][i];
+                    amaf_moves[process_num][i].insert(amaf_moves[process_num][i].end(), moves.begin(), moves.end());
+                    moves.clear();
+                }
+            }
         }
     }
     else
@@ -100,47 +259,78 @@ double MonteCarloTreeSearch::uct(Node* n, const int agent_idx, const int process
     if (cfg.heuristic_coef > 0)
     {
         const auto position = penvs[process_num].cur_positions[agent_idx];
-        const auto move = penvs[process_num].moves[n->action_id];
-        const int lenpath = shortest_paths[agent_idx][position.first][position.second] - shortest_paths[agent_idx][position.first + move.first][position.second + move.second];
-        uct_val += cfg.heuristic_coef * lenpath / n->cnt;
+        uct_val += cfg.heuristic_coef * distance_gain(agent_idx, position, n->action_id) / n->cnt;
     }
     return uct_val;
 }
 
-double MonteCarloTreeSearch::batch_uct(Node* n) const
+// how much closer to the goal an action moves the agent, moves off the grid or into obstacles gain nothing
+double MonteCarloTreeSearch::distance_gain(const int agent_idx, const std::pair<int, int> position, const int action) const
 {
-    const int adjusted_count = n->cnt + n->cnt_sne;
-    return n->w/adjusted_count + cfg.uct_c * std::sqrt(2.0 * std::log(n->parent->cnt + n->parent->cnt_sne)/adjusted_count);
+    const auto& distances = shortest_paths[agent_idx];
+    const auto move = penvs[0].moves[action];
+    const int i = position.first + move.first, j = position.second + move.second;
+    if (i < 0 || j < 0 || i >= static_cast<int>(distances.size()) || j >= static_cast<int>(distances[i].size()) || distances[i][j] >= 1000000)
+    {
+        return 0;
+    }
+    return static_cast<int>(distances[position.first][position.second] - distances[i][j]);
 }
 
 int MonteCarloTreeSearch::expansion(Node* n, const int agent_idx, const int process_num = 0) const
 {
-    int best_action(0), k(0);
-    double best_score(-1000000);
-    for(auto c: n->child_nodes)
+    if (cfg.use_puct)
     {
-        if ((cfg.use_move_limits && penvs[process_num].check_action(agent_idx, k, cfg.agents_as_obstacles)) || !cfg.use_move_limits)
+        return puct_expansion(n, agent_idx, process_num);
+    }
+    const auto& env = penvs[process_num];
+    int actions[UctKernel::max_children], num(0);
+    double q[UctKernel::max_children], bonus[UctKernel::max_children];
+    uint64_t cnt[UctKernel::max_children];
+    const auto position = env.cur_positions[agent_idx];
+    for(int k = 0; k < n->num_actions_; k++)
+    {
+        if (cfg.use_move_limits && !env.check_action(agent_idx, k, cfg.agents_as_obstacles))
         {
-            if(c == nullptr)
-            {
-                return k;
-            }
-            const auto uct_val = uct(c, agent_idx, process_num);
-            if (uct_val > best_score)
-            {
-                best_action = k;
-                best_score = uct_val;
-            }
+            continue;
+        }
+        const Node* c = n->child_nodes[k];
+        if(c == nullptr)
+        {
+            return k;
         }
-        k++;
+        actions[num] = k;
+        q[num] = child_value(n, c, k);
+        cnt[num] = c->cnt;
+        bonus[num] = 0;
+        if (cfg.heuristic_coef > 0)
+        {
+            bonus[num] = cfg.heuristic_coef * distance_gain(agent_idx, position, k);
+        }
+        num++;
+    }
+    if (num == 0)
+    {
+        return 0;
     }
-    return best_action;
+    double best_score;
+    return actions[UctKernel::best(q, cnt, bonus, num, cfg.uct_c, n->cnt, best_score)];
 }
 
 double MonteCarloTreeSearch::selection(Node* n, std::vector<int> actions, const int process_num = 0)
 {
     int agent_idx = int(actions.size())%penvs[process_num].get_num_agents();
     int next_agent_idx = (agent_idx + 1)%penvs[process_num].get_num_agents();
+    if (cfg.collect_stats)
+    {
+        descent_clocks[process_num].depth++;
+    }
+    if(cfg.collapse_finished_agents && agent_idx != 0 && actions.size() < penvs[process_num].get_num_agents() && penvs[process_num].reached_goal(agent_idx))
+    {
+        // finished agents always wait, so their level is folded into the node of the next agent
+        actions.push_back(0);
+        return selection(n, actions, process_num)*cfg.gamma;
+    }
     int action(0);
     double score;
     if(!penvs[process_num].reached_goal(agent_idx))
@@ -152,18 +342,28 @@ double MonteCarloTreeSearch::selection(Node* n, std::vector<int> actions, const
         double reward = penvs[process_num].step(actions);
         actions.clear();
         if(penvs[process_num].all_done())
+        {
             score = reward;
+            if (cfg.collect_stats)
+                descent_clocks[process_num].leaf = descent_clocks[process_num].rollout_done = SearchCounters::now();
+        }
         else
         {
             if(n->child_nodes[action] == nullptr)
             {
+                if (cfg.collect_stats)
+                    descent_clocks[process_num].leaf = SearchCounters::now();
                 score = reward + cfg.gamma*simulation(process_num);
+                if (cfg.collect_stats)
+                    descent_clocks[process_num].rollout_done = SearchCounters::now();
                 n->child_nodes[action] = safe_insert_node(n, action, score, cfg.num_actions, next_agent_idx);
+                num_expanded.fetch_add(1, std::memory_order_relaxed);
             }
             else
                 score = reward +cfg.gamma*selection(n->child_nodes[action], {action}, process_num);
         }
         n->update_value(score);
+        update_amaf(n, agent_idx, action, process_num, score);
         penvs[process_num].step_back();
     }
     else
@@ -175,42 +375,149 @@ double MonteCarloTreeSearch::selection(Node* n, std::vector<int> actions, const
         actions.push_back(action);
         score = selection(n->child_nodes[action], actions, process_num);
         n->update_value(score);
+        update_amaf(n, agent_idx, action, process_num, score);
     }
     return score*cfg.gamma;
 }
 
-int MonteCarloTreeSearch::select_action_for_batch_path(Node* n, const int agent_idx, const int process_num = 0)
+void MonteCarloTreeSearch::begin_descent(const int process_num)
 {
-    int best_action(0), k(0);
-    double best_score(-1);
-    for(auto c: n->child_nodes)
+    if (cfg.collect_stats)
+    {
+        descent_clocks[process_num] = DescentClock();
+        descent_clocks[process_num].start = SearchCounters::now();
+    }
+}
+
+// splits the descent into selection down to the leaf, the rollout there and the backup on the way up
+void MonteCarloTreeSearch::end_descent(const int process_num)
+{
+    if (!cfg.collect_stats)
+    {
+        return;
+    }
+    auto& clock = descent_clocks[process_num];
+    const uint64_t end = SearchCounters::now();
+    if (clock.leaf == 0)
+    {
+        clock.leaf = clock.rollout_done = end;
+    }
+    counters.selection_ns += clock.leaf - clock.start;
+    counters.rollout_ns += clock.rollout_done - clock.leaf;
+    counters.backup_ns += end - clock.rollout_done;
+    counters.add_descent(clock.depth);
+}
+
+bool MonteCarloTreeSearch::rave_enabled() const
+{
+    // batch workers share nodes during backup, RAVE statistics are only kept by the sequential descents;
+    // decoupled search has no per-agent tree nodes to keep them in
+    return cfg.use_rave && cfg.batch_size <= 1 && !cfg.decoupled_search;
+}
+
+void MonteCarloTreeSearch::reset_amaf(const int process_num)
+{
+    if (rave_enabled())
     {
-        if ((cfg.use_move_limits && penvs[process_num].check_action(agent_idx, k, cfg.agents_as_obstacles)) || !cfg.use_move_limits)
+        for(auto& moves: amaf_moves[process_num])
         {
-            if(c == nullptr && !n->mask_picked[k])
-                return k;
-            else if (c == nullptr)
-            {
-                k++;
-                continue;
-            }
-            const auto uct_val = batch_uct(c);
-            if (uct_val > best_score)
+            moves.clear();
+        }
+    }
+}
+
+void MonteCarloTreeSearch::update_amaf(Node* n, const int agent_idx, const int action, const int process_num, const double score)
+{
+    if (rave_enabled())
+    {
+        // siblings share the agent's cell, so every action the agent later took from this cell counts as played here
+        auto& moves = amaf_moves[process_num][agent_idx];
+        const auto cell = penvs[process_num].cur_positions[agent_idx];
+        moves.push_back({cell, action});
+        uint32_t mask(0);
+        for(const auto& move: moves)
+        {
+            if (move.first == cell)
             {
-                best_action = k;
-                best_score = uct_val;
+                mask |= 1u << move.second;
             }
         }
-        k++;
+        n->update_rave(mask, score);
+    }
+}
+
+double MonteCarloTreeSearch::child_value(const Node* n, const Node* c, const int action) const
+{
+    if (!rave_enabled() || n->rave_cnt.empty() || n->rave_cnt[action] == 0)
+    {
+        return c->q;
+    }
+    const double beta = std::sqrt(cfg.rave_k / (3.0 * c->cnt + cfg.rave_k));
+    return (1 - beta) * c->q + beta * n->rave_w[action] / n->rave_cnt[action];
+}
+
+int MonteCarloTreeSearch::puct_expansion(Node* n, const int agent_idx, const int process_num) const
+{
+    const auto& env = penvs[process_num];
+    int actions[UctKernel::max_children], num(0);
+    double q[UctKernel::max_children], prior[UctKernel::max_children];
+    uint64_t cnt[UctKernel::max_children];
+    const uint8_t* cell_priors = priors.at(agent_idx, env.cur_positions[agent_idx]);
+    for(int k = 0; k < n->num_actions_; k++)
+    {
+        if (cfg.use_move_limits && !env.check_action(agent_idx, k, cfg.agents_as_obstacles))
+        {
+            continue;
+        }
+        // unexpanded children compete through their prior, valued like their parent
+        const Node* c = n->child_nodes[k];
+        actions[num] = k;
+        q[num] = (c == nullptr) ? n->q : child_value(n, c, k);
+        cnt[num] = (c == nullptr) ? 0 : c->cnt;
+        prior[num] = cell_priors[k] / 255.0;
+        num++;
+    }
+    if (num == 0)
+    {
+        return 0;
     }
-    if (best_score < 0)
+    double best_score;
+    return actions[UctKernel::best_puct(q, cnt, prior, num, cfg.puct_c, n->cnt, best_score)];
+}
+
+int MonteCarloTreeSearch::select_action_for_batch_path(Node* n, const int agent_idx, const int process_num = 0)
+{
+    int actions[UctKernel::max_children], num(0);
+    double q[UctKernel::max_children], bonus[UctKernel::max_children];
+    uint64_t cnt[UctKernel::max_children];
+    for(int k = 0; k < n->num_actions_; k++)
     {
-        best_action = -1;
+        if (cfg.use_move_limits && !penvs[process_num].check_action(agent_idx, k, cfg.agents_as_obstacles))
+        {
+            continue;
+        }
+        const Node* c = n->child_nodes[k];
+        if(c == nullptr && !n->mask_picked[k])
+        {
+            return k;
+        }
+        else if (c == nullptr)
+        {
+            continue;
+        }
+        // virtual losses count as visits without reward
+        actions[num] = k;
+        cnt[num] = c->cnt + c->cnt_sne;
+        q[num] = c->w / cnt[num];
+        bonus[num] = 0;
+        num++;
     }
-    return best_action;
+    double best_score(-1);
+    const int best = (num == 0) ? -1 : UctKernel::best(q, cnt, bonus, num, cfg.uct_c, n->cnt + n->cnt_sne, best_score);
+    return (best_score < 0) ? -1 : actions[best];
 }
 
-std::vector<int> MonteCarloTreeSearch::batch_selection(Node* n, std::vector<int> actions, const int process_num = 0)
+std::vector<int> MonteCarloTreeSearch::batch_selection(Node* n, std::vector<int> actions, const int process_num = 0, Node** leaf = nullptr)
 {
     int agent_idx = int(actions.size())%penvs[process_num].get_num_agents();
     int action(0);
@@ -219,29 +526,48 @@ std::vector<int> MonteCarloTreeSearch::batch_selection(Node* n, std::vector<int>
     actions.push_back(action);
     if (action < 0)
     {
+        if (leaf != nullptr)
+            *leaf = n;
         return actions;
     }
     if (n->child_nodes[action] == nullptr)
     {
         n->mask_picked[action] = true;
         n->cnt_sne += 1;
+        if (leaf != nullptr)
+            *leaf = n;
         return actions;
     }
     else
     {
-        auto new_actions = batch_selection(n->child_nodes[action], actions, process_num);
+        auto new_actions = batch_selection(n->child_nodes[action], actions, process_num, leaf);
         n->cnt_sne += 1;
         return new_actions;
     }
 }
 
+void MonteCarloTreeSearch::release_virtual_loss(Node* n)
+{
+    while (n != nullptr)
+    {
+        n->cnt_sne -= 1;
+        if (n == root)
+            break;
+        n = n->parent;
+    }
+}
+
 double MonteCarloTreeSearch::batch_expansion(std::vector<int> path_actions, std::vector<int> prev_actions, const int process_num = 0)
 {
+    TRACE_SPAN("batch_expansion");
+    const uint64_t start = cfg.collect_stats ? SearchCounters::now() : 0;
     double score = 0.0;
     double g = 1.0;
+    int num_steps(0);
     if(prev_actions.size() == penvs[process_num].get_num_agents())
     {
         double reward = penvs[process_num].step(prev_actions);
+        num_steps++;
         score += g * reward;
         g *= cfg.gamma;
         prev_actions.clear();
@@ -252,6 +578,7 @@ double MonteCarloTreeSearch::batch_expansion(std::vector<int> path_actions, std:
         if(prev_actions.size() == penvs[process_num].get_num_agents())
         {
             double reward = penvs[process_num].step(prev_actions);
+            num_steps++;
             score += g * reward;
             g *= cfg.gamma;
             prev_actions.clear();
@@ -261,25 +588,59 @@ double MonteCarloTreeSearch::batch_expansion(std::vector<int> path_actions, std:
     {
         score += cfg.gamma * simulation(process_num);
     }
+    // the environment is reused by the next batch, so it has to be back at the root state
+    for (int i = 0; i < num_steps; i++)
+    {
+        penvs[process_num].step_back();
+    }
+    if (start != 0)
+    {
+        counters.rollout_ns += SearchCounters::now() - start;
+    }
     return score;
 }
 
-void MonteCarloTreeSearch::loop(std::vector<int>& prev_actions)
+void MonteCarloTreeSearch::loop(std::vector<int>& prev_actions, const int num_iterations)
 {
-    for (int i = 0; i < cfg.num_expansions; i++)
+    TRACE_SPAN("loop");
+    for (int i = 0; i < num_iterations && !stop_search; i++)
     {
+        reset_amaf(0);
+        begin_descent(0);
         double score = selection(root, prev_actions, 0);
         root->update_value(score);
+        end_descent(0);
+        if (decided(root, num_iterations - i - 1))
+        {
+            iterations_saved += num_iterations - i - 1;
+            break;
+        }
     }
 }
 
-void MonteCarloTreeSearch::batch_loop(std::vector<int>& prev_actions)
+std::vector<int> MonteCarloTreeSearch::child_widths() const
 {
-    for (int i = 0; i < cfg.num_expansions; i++)
+    // batch selection reads goal flags at the root state, agents finished there stay finished below it
+    std::vector<int> widths(penvs[0].get_num_agents(), cfg.num_actions);
+    for(size_t agent_idx = 0; agent_idx < widths.size() && cfg.collapse_finished_agents; agent_idx++)
+    {
+        if(penvs[0].reached_goal(agent_idx))
+        {
+            widths[agent_idx] = 1;
+        }
+    }
+    return widths;
+}
+
+void MonteCarloTreeSearch::batch_loop(std::vector<int>& prev_actions, const int num_iterations)
+{
+    TRACE_SPAN("batch_loop");
+    const auto widths = child_widths();
+    for (int i = 0; i < num_iterations && !stop_search; i++)
     {
         root->zero_snes();
-        std::vector<std::future<double>> pool_futures;
         std::vector<std::vector<int>> batch_paths;
+        uint64_t start = cfg.collect_stats ? SearchCounters::now() : 0;
         for(int batch = 0; batch < cfg.batch_size; batch++)
         {
             auto batch_actions = batch_selection(root, prev_actions, batch);
@@ -287,10 +648,19 @@ void MonteCarloTreeSearch::batch_loop(std::vector<int>& prev_actions)
             {
                 for([[maybe_unused]] auto& _ : prev_actions)
                     pop_front(batch_actions);
+                if (start != 0)
+                    counters.add_descent(batch_actions.size());
                 batch_paths.push_back(batch_actions);
-                pool_futures.push_back(pool.submit(&MonteCarloTreeSearch::batch_expansion, this, batch_actions, prev_actions, batch));
             }
         }
+        if (start != 0)
+            counters.selection_ns += SearchCounters::now() - start;
+        std::vector<double> scores(batch_paths.size());
+        fork_join(batch_paths.size(), [this, &scores, &batch_paths, &prev_actions](const int batch)
+        {
+            scores[batch] = batch_expansion(batch_paths[batch], prev_actions, batch);
+        });
+        start = cfg.collect_stats ? SearchCounters::now() : 0;
         for (size_t enum_paths = 0; enum_paths < batch_paths.size(); enum_paths++)
         {
             Node* local_root = root;
@@ -298,11 +668,13 @@ void MonteCarloTreeSearch::batch_loop(std::vector<int>& prev_actions)
             {
                 local_root = local_root->child_nodes[batch_paths[enum_paths][enum_actions]];
             }
-            const auto score = pool_futures[enum_paths].get();
+            const auto score = scores[enum_paths];
             const auto action = batch_paths[enum_paths][batch_paths[enum_paths].size() - 1];
             if(local_root->child_nodes[action] == nullptr)
             {
-                local_root->child_nodes[action] = safe_insert_node(local_root, action, score, cfg.num_actions, (local_root->agent_id + 1) % penvs[0].get_num_agents());
+                const int next_agent_idx = (local_root->agent_id + 1) % penvs[0].get_num_agents();
+                local_root->child_nodes[action] = safe_insert_node(local_root, action, score, widths[next_agent_idx], next_agent_idx);
+                num_expanded.fetch_add(1, std::memory_order_relaxed);
                 local_root->update_value_batch(score);
             }
             else
@@ -310,6 +682,166 @@ void MonteCarloTreeSearch::batch_loop(std::vector<int>& prev_actions)
                 local_root->child_nodes[action]->update_value_batch(score);
             }
         }
+        if (start != 0)
+            counters.backup_ns += SearchCounters::now() - start;
+        const uint64_t remaining = static_cast<uint64_t>(num_iterations - i - 1) * cfg.batch_size;
+        if (decided(root, remaining))
+        {
+            iterations_saved += remaining;
+            break;
+        }
+    }
+}
+
+void MonteCarloTreeSearch::pipelined_batch_loop(std::vector<int>& prev_actions, const int num_iterations)
+{
+    TRACE_SPAN("pipelined_batch_loop");
+    struct Completions
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<int> slots;
+    };
+    struct Rollout
+    {
+        MonteCarloTreeSearch* mcts;
+        const std::vector<int>* prev_actions;
+        Completions* completions;
+        int slot;
+        Node* leaf;
+        int action;
+        std::vector<int> path_actions;
+        double score;
+        std::exception_ptr error;
+        uint64_t queued;
+
+        void operator()()
+        {
+            if (queued != 0)
+            {
+                mcts->counters.pool_wait_ns += SearchCounters::now() - queued;
+            }
+            try
+            {
+                score = mcts->batch_expansion(path_actions, *prev_actions, slot);
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+            const std::lock_guard<std::mutex> lock(completions->mutex);
+            completions->slots.push_back(slot);
+            completions->cv.notify_one();
+        }
+    };
+    Completions completions;
+    const auto widths = child_widths();
+    const int total_rollouts = num_iterations * cfg.batch_size;
+    std::vector<Rollout> rollouts(cfg.batch_size);
+    std::vector<int> free_slots;
+    for (int slot = cfg.batch_size - 1; slot >= 0; slot--)
+    {
+        rollouts[slot].mcts = this;
+        rollouts[slot].prev_actions = &prev_actions;
+        rollouts[slot].completions = &completions;
+        rollouts[slot].slot = slot;
+        free_slots.push_back(slot);
+    }
+    WS::pool* ws = cfg.work_stealing ? &stealing_pool() : nullptr;
+    BS::thread_pool* threads = ws ? nullptr : &thread_pool();
+    WS::task_group group;
+    std::exception_ptr error;
+    int launched(0), in_flight(0), completed(0);
+    bool stopped_early(false);
+    root->zero_snes();
+    while (launched < total_rollouts || in_flight > 0)
+    {
+        // keep batch_size rollouts in flight, a free slot's environment is at the root state
+        while (launched < total_rollouts && !free_slots.empty() && !error && !stop_search && !stopped_early)
+        {
+            const int slot = free_slots.back();
+            Node* leaf = nullptr;
+            const uint64_t start = cfg.collect_stats ? SearchCounters::now() : 0;
+            auto path_actions = batch_selection(root, prev_actions, slot, &leaf);
+            if (start != 0)
+                counters.selection_ns += SearchCounters::now() - start;
+            if (path_actions.back() < 0)
+            {
+                // everything reachable is already being evaluated, wait for a result instead
+                if (leaf != root)
+                    release_virtual_loss(leaf->parent);
+                break;
+            }
+            free_slots.pop_back();
+            for([[maybe_unused]] auto& _ : prev_actions)
+                pop_front(path_actions);
+            if (start != 0)
+                counters.add_descent(path_actions.size());
+            auto& rollout = rollouts[slot];
+            rollout.leaf = leaf;
+            rollout.action = path_actions.back();
+            rollout.path_actions = std::move(path_actions);
+            rollout.queued = cfg.collect_stats ? SearchCounters::now() : 0;
+            if (ws)
+                ws->spawn(group, rollout);
+            else
+                threads->push_task([&rollout]{ in_pool_task = true; rollout(); });
+            launched++;
+            in_flight++;
+        }
+        if (in_flight == 0)
+        {
+            break;
+        }
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(completions.mutex);
+            completions.cv.wait(lock, [&completions]{ return !completions.slots.empty(); });
+            slot = completions.slots.front();
+            completions.slots.pop_front();
+        }
+        in_flight--;
+        completed++;
+        free_slots.push_back(slot);
+        const uint64_t start = cfg.collect_stats ? SearchCounters::now() : 0;
+        auto& rollout = rollouts[slot];
+        Node* leaf = rollout.leaf;
+        const int action = rollout.action;
+        release_virtual_loss(leaf);
+        leaf->mask_picked[action] = false;
+        if (rollout.error)
+        {
+            // stop launching, but let the rollouts in flight finish before leaving
+            error = rollout.error;
+            continue;
+        }
+        if(leaf->child_nodes[action] == nullptr)
+        {
+            const int next_agent_idx = (leaf->agent_id + 1) % penvs[0].get_num_agents();
+            leaf->child_nodes[action] = safe_insert_node(leaf, action, rollout.score, widths[next_agent_idx], next_agent_idx);
+            num_expanded.fetch_add(1, std::memory_order_relaxed);
+            leaf->update_value_batch(rollout.score);
+        }
+        else
+        {
+            leaf->child_nodes[action]->update_value_batch(rollout.score);
+        }
+        if (start != 0)
+            counters.backup_ns += SearchCounters::now() - start;
+        if (!stopped_early && decided(root, total_rollouts - completed))
+        {
+            // the rollouts in flight still finish, only the ones not launched yet are saved
+            stopped_early = true;
+            iterations_saved += total_rollouts - launched;
+        }
+    }
+    if (ws)
+    {
+        ws->wait(group);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
     }
 }
 
@@ -332,157 +864,935 @@ void MonteCarloTreeSearch::retrieve_statistics(Node* tree, Node* from_root)
     }
 }
 
-void MonteCarloTreeSearch::tree_parallelization_loop_internal(std::vector<int> prev_actions, const int process_num)
+void MonteCarloTreeSearch::tree_parallelization_loop_internal(std::vector<int> prev_actions, const int process_num, const int num_iterations)
 {
-    for (int i = 0; i < cfg.num_expansions; i++)
+    TRACE_SPAN("tree_parallelization_loop_internal");
+    for (int i = 0; i < num_iterations && !stop_search; i++)
     {
+        reset_amaf(process_num);
+        begin_descent(process_num);
         double score = selection(ptrees[process_num], prev_actions, process_num);
         ptrees[process_num]->update_value(score);
+        end_descent(process_num);
     }
 }
 
-void MonteCarloTreeSearch::tree_parallelization_loop(std::vector<int>& prev_actions)
+void MonteCarloTreeSearch::tree_parallelization_loop(std::vector<int>& prev_actions, const int num_iterations)
 {
-    std::vector<std::future<void>> futures;
-    for(int i = 0; i < cfg.num_parallel_trees; i++)
+    TRACE_SPAN("tree_parallelization_loop");
+    fork_join(cfg.num_parallel_trees, [this, &prev_actions, num_iterations](const int i)
     {
-        futures.push_back(pool.submit(&MonteCarloTreeSearch::tree_parallelization_loop_internal, this, prev_actions, i));
-    }
-    futures[0].get();
-    for(int i = 1; i < cfg.num_parallel_trees; i++)
+        tree_parallelization_loop_internal(prev_actions, i, num_iterations);
+    });
     {
-        futures[i].get();
-        retrieve_statistics(ptrees[i], root);
+        TRACE_SPAN("retrieve_statistics");
+        const uint64_t start = cfg.collect_stats ? SearchCounters::now() : 0;
+        for(int i = 1; i < cfg.num_parallel_trees; i++)
+        {
+            retrieve_statistics(ptrees[i], root);
+        }
+        root->update_q();
+        if (start != 0)
+            counters.merge_ns += SearchCounters::now() - start;
     }
-    root->update_q();
 }
 
-std::vector<int> MonteCarloTreeSearch::act()
+Node* MonteCarloTreeSearch::tree(const int tree_idx) const
 {
-    std::vector<int> actions;
-    if (penvs[0].all_done())
+    return ptrees[tree_idx];
+}
+
+bool MonteCarloTreeSearch::decided(const Node* n, const uint64_t remaining) const
+{
+    if (!cfg.early_stop)
     {
-        for(size_t agent_idx = 0; agent_idx < penvs[0].get_num_agents(); agent_idx++)
+        return false;
+    }
+    if (!cfg.joint_search)
+    {
+        return decided_level(n, remaining);
+    }
+    // a joint search reads every agent's action off the principal path, each of them has to be settled
+    for(size_t level = 0; level < penvs[0].get_num_agents(); level++)
+    {
+        if (n == nullptr || !decided_level(n, remaining))
         {
-            actions.push_back(0);
+            return false;
         }
-        return actions;
+        const int action = n->get_action();
+        n = (action < 0) ? nullptr : n->child_nodes[action];
     }
-    std::vector<char> action_names = {'S','U', 'D', 'L', 'R'};
-    for(size_t agent_idx = 0; agent_idx < penvs[0].get_num_agents(); agent_idx++)
+    return true;
+}
+
+bool MonteCarloTreeSearch::decided_level(const Node* n, const uint64_t remaining) const
+{
+    const Node* leader = nullptr;
+    const Node* runner_up = nullptr;
+    for(auto c: n->child_nodes)
     {
-        try
+        if (c == nullptr)
         {
-            if (!penvs[0].reached_goal(agent_idx))
-            {
-                if (cfg.batch_size > 1)
-                {
-                    batch_loop(actions);
-                }
-                else if (cfg.num_parallel_trees > 1)
-                {
-                    tree_parallelization_loop(actions);
-                }
-                else
-                {
-                    loop(actions);
-                }
-            }
+            continue;
         }
-        catch(const std::exception& e)
+        if (leader == nullptr || c->cnt > leader->cnt)
         {
-            std::cerr << e.what() << '\n';
-            std::cout<<"loop\n";
+            runner_up = leader;
+            leader = c;
         }
-
-        if (cfg.render)
+        else if (runner_up == nullptr || c->cnt > runner_up->cnt)
         {
-            std::cout<<agent_idx<<" "<<root->q<<std::endl;
-            for(int i = 0; i < cfg.num_actions; i++) {
-                int cnt = (root->child_nodes[i] == nullptr) ? 0 : root->child_nodes[i]->cnt;
-                std::cout << action_names[i] << ":" << cnt << " ";
-            }
-            std::cout<<std::endl;
-            for(int i = 0; i < cfg.num_actions; i++) {
-                double c = (root->child_nodes[i] == nullptr) ? 0.0 : uct(root->child_nodes[i], agent_idx, 0);
-                std::cout << action_names[i] << ":" << c << " ";
-            }
-            std::cout<<std::endl;
-            std::cout<<"---------------------------------------------------------------------\n";
+            runner_up = c;
         }
-        int action = root->get_action();
-        root = root->child_nodes[action];
-        for(int i = 0; i < cfg.num_parallel_trees; i++)
-        {
-            if(ptrees[i]->child_nodes[action] != nullptr)
-            {
-                ptrees[i] = ptrees[i]->child_nodes[action];
-            }
-            else
-            {
-                ptrees[i]->child_nodes[action] = safe_insert_node(ptrees[i], action, 0, cfg.num_actions, (agent_idx + 1) % penvs[i].get_num_agents());
-            }
+    }
+    if (leader == nullptr)
+    {
+        return false;
+    }
+    // get_action() picks the most visited child, no other child can catch up within the remaining iterations
+    const uint64_t second_cnt = (runner_up == nullptr) ? 0 : runner_up->cnt;
+    if (leader->cnt - second_cnt > remaining)
+    {
+        return true;
+    }
+    if (cfg.early_stop_confidence <= 0 || runner_up == nullptr)
+    {
+        return false;
+    }
+    const auto bound = [this, n](const Node* c)
+    {
+        return cfg.early_stop_confidence*std::sqrt(2.0*std::log(n->cnt)/c->cnt);
+    };
+    const double leader_lower = leader->q - bound(leader);
+    for(auto c: n->child_nodes)
+    {
+        if (c != nullptr && c != leader && c->q + bound(c) >= leader_lower)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t MonteCarloTreeSearch::get_iterations_saved() const
+{
+    return iterations_saved;
+}
+
+uint64_t MonteCarloTreeSearch::get_num_expanded() const
+{
+    return num_expanded;
+}
+
+uint64_t MonteCarloTreeSearch::get_num_rollouts() const
+{
+    return num_rollouts;
+}
+
+SearchStats MonteCarloTreeSearch::get_stats()
+{
+    const std::lock_guard<std::mutex> lock(act_mutex);
+    SearchStats stats;
+    counters.fill(stats);
+    stats.expansions = num_expanded;
+    stats.rollouts = num_rollouts;
+    if (stats.search_seconds > 0)
+    {
+        stats.expansions_per_second = stats.expansions / stats.search_seconds;
+        stats.rollouts_per_second = stats.rollouts / stats.search_seconds;
+    }
+    stats.num_nodes = num_nodes + all_decoupled_nodes.size();
+    stats.node_bytes = node_bytes;
+    stats.node_bytes += all_decoupled_nodes.size() * (sizeof(DecoupledNode) + 2 * sizeof(void*));
+    return stats;
+}
+
+void MonteCarloTreeSearch::reset_stats()
+{
+    const std::lock_guard<std::mutex> lock(act_mutex);
+    counters.reset();
+    num_expanded = 0;
+    num_rollouts = 0;
+}
+
+void MonteCarloTreeSearch::search(std::vector<int>& prev_actions, const int num_iterations)
+{
+    const uint64_t start = SearchCounters::now();
+    if (cfg.batch_size > 1 && cfg.pipelined_batch)
+    {
+        pipelined_batch_loop(prev_actions, num_iterations);
+    }
+    else if (cfg.batch_size > 1)
+    {
+        batch_loop(prev_actions, num_iterations);
+    }
+    else if (cfg.num_parallel_trees > 1)
+    {
+        tree_parallelization_loop(prev_actions, num_iterations);
+    }
+    else
+    {
+        loop(prev_actions, num_iterations);
+    }
+    counters.search_ns += SearchCounters::now() - start;
+}
+
+// The workers search the same state with their own seeds; their root statistics are merged into the root.
+// A worker that misses the deadline is restarted and only costs its share of the iterations.
+void MonteCarloTreeSearch::multi_process_search(std::vector<int>& prev_actions, const int num_iterations)
+{
+    const int num_workers = cfg.num_processes - 1;
+    workers.resize(std::max(num_workers, 0));
+    Config worker_cfg = cfg;
+    worker_cfg.num_processes = 1;
+    worker_cfg.ponder_expansions = 0;
+    worker_cfg.render = false;
+    worker_cfg.affinity = "none";
+    std::vector<int> goals, positions;
+    for(size_t i = 0; i < penvs[0].get_num_agents(); i++)
+    {
+        goals.insert(goals.end(), {penvs[0].goals[i].first, penvs[0].goals[i].second});
+        positions.insert(positions.end(), {penvs[0].cur_positions[i].first, penvs[0].cur_positions[i].second});
+    }
+    const int threads = std::max(1, pool_size / cfg.num_processes);
+    const uint64_t job = ++worker_jobs;
+
+    // workers started now get worker_timeout_ms to come up
+    const uint64_t start_deadline = Workers::now_ms() + cfg.worker_timeout_ms;
+    std::vector<bool> started(num_workers, false), posted(num_workers, false);
+    for(int worker = 0; worker < num_workers; worker++)
+    {
+        if (!workers[worker])
+        {
+            workers[worker] = std::make_unique<Workers::Process>();
+        }
+        if (!workers[worker]->running() && !workers[worker]->disabled())
+        {
+            started[worker] = workers[worker]->start();
+        }
+    }
+    for(int worker = 0; worker < num_workers; worker++)
+    {
+        if (!workers[worker]->wait_ready(started[worker] ? start_deadline : 0))
+        {
+            continue;
+        }
+        if (cfg.seed >= 0)
+        {
+            worker_cfg.seed = static_cast<int>(mix_hash(static_cast<uint64_t>(cfg.seed) + worker + 1) & 0x7fffffff);
+        }
+        Workers::Writer setup;
+        setup.put(config_to_text(worker_cfg));
+        setup.put(penvs[0].grid);
+        setup.put(goals);
+        setup.put(obs_radius);
+        setup.put(threads);
+        setup.put(mix_hash(worker + 1));
+        Workers::Writer request;
+        request.put(setup.data);
+        request.put(positions);
+        request.put(root->agent_id);
+        request.put(prev_actions);
+        request.put(num_iterations);
+        posted[worker] = workers[worker]->post(job, request.data);
+    }
+    search(prev_actions, num_iterations);
+
+    // merging includes waiting for workers that are still searching
+    TRACE_SPAN("multi_process_merge");
+    const uint64_t start = cfg.collect_stats ? SearchCounters::now() : 0;
+    const uint64_t deadline = Workers::now_ms() + cfg.worker_timeout_ms;
+    const int next_agent_idx = (root->agent_id + 1) % penvs[0].get_num_agents();
+    for(int worker = 0; worker < num_workers; worker++)
+    {
+        std::string result;
+        if (!posted[worker] || !workers[worker]->collect(job, deadline, result))
+        {
+            continue;
+        }
+        std::vector<uint64_t> cnt;
+        std::vector<double> w;
+        uint64_t expanded(0), rollouts(0);
+        Workers::Reader reader(result);
+        reader.get(cnt);
+        reader.get(w);
+        reader.get(expanded);
+        reader.get(rollouts);
+        num_expanded += expanded;
+        num_rollouts += rollouts;
+        for(int k = 0; k < root->num_actions_ && k < static_cast<int>(std::min(cnt.size(), w.size())); k++)
+        {
+            if (cnt[k] == 0)
+            {
+                continue;
+            }
+            if (root->child_nodes[k] == nullptr)
+            {
+                root->child_nodes[k] = safe_insert_node(root, k, 0, cfg.num_actions, next_agent_idx);
+            }
+            Node* c = root->child_nodes[k];
+            c->cnt += cnt[k];
+            c->w += w[k];
+            c->q = c->w / c->cnt;
+            root->cnt += cnt[k];
+            root->w += w[k];
+        }
+        if (root->cnt > 0)
+        {
+            root->q = root->w / root->cnt;
+        }
+    }
+    if (start != 0)
+        counters.merge_ns += SearchCounters::now() - start;
+}
+
+// one job of a worker process: a fresh search of the coordinator's state, answered with the root statistics
+std::string MonteCarloTreeSearch::worker_search(const std::vector<int>& positions, const int agent_idx, std::vector<int>& prev_actions, const int num_iterations)
+{
+    clear_trees(agent_idx);
+    std::vector<std::pair<int, int>> cells;
+    for(size_t i = 0; i + 1 < positions.size(); i += 2)
+    {
+        cells.emplace_back(positions[i], positions[i + 1]);
+    }
+    for(auto& e: penvs)
+    {
+        e.set_positions(cells);
+    }
+    plan_cache.clear();
+    const uint64_t expanded = num_expanded, rollouts = num_rollouts;
+    search(prev_actions, num_iterations);
+    std::vector<uint64_t> cnt(root->num_actions_, 0);
+    std::vector<double> w(root->num_actions_, 0);
+    for(int k = 0; k < root->num_actions_; k++)
+    {
+        if (root->child_nodes[k] != nullptr)
+        {
+            cnt[k] = root->child_nodes[k]->cnt;
+            w[k] = root->child_nodes[k]->w;
+        }
+    }
+    Workers::Writer result;
+    result.put(cnt);
+    result.put(w);
+    result.put(num_expanded - expanded);
+    result.put(num_rollouts - rollouts);
+    return result.data;
+}
+
+// frees every node and starts empty trees at the level of agent_idx
+void MonteCarloTreeSearch::clear_trees(const int agent_idx)
+{
+    {
+        const std::lock_guard<std::mutex> lock(all_nodes.mutex);
+        all_nodes.nodes.clear();
+    }
+    num_nodes = 0;
+    node_bytes = 0;
+    for(auto& tree: ptrees)
+    {
+        tree = safe_insert_node(nullptr, -1, 0, cfg.num_actions, agent_idx);
+    }
+    root = ptrees[0];
+}
+
+void MonteCarloTreeSearch::serve_search_worker()
+{
+    // the search is rebuilt only when the coordinator's config, map or seed changes
+    std::unique_ptr<MonteCarloTreeSearch> mcts;
+    std::string current_setup;
+    Workers::serve([&mcts, &current_setup](const std::string& payload)
+    {
+        std::string setup;
+        std::vector<int> positions, prev_actions;
+        int agent_idx(0), num_iterations(0);
+        Workers::Reader request(payload);
+        request.get(setup);
+        request.get(positions);
+        request.get(agent_idx);
+        request.get(prev_actions);
+        request.get(num_iterations);
+        if (!mcts || setup != current_setup)
+        {
+            std::string config_text;
+            std::vector<std::vector<int>> grid;
+            std::vector<int> goals;
+            int obs_radius(0), threads(1);
+            uint64_t salt(0);
+            Workers::Reader reader(setup);
+            reader.get(config_text);
+            reader.get(grid);
+            reader.get(goals);
+            reader.get(obs_radius);
+            reader.get(threads);
+            reader.get(salt);
+            Environment env;
+            env.grid = grid;
+            for(size_t i = 0; i + 1 < goals.size() && i + 1 < positions.size(); i += 2)
+            {
+                env.add_agent(positions[i], positions[i + 1], goals[i], goals[i + 1]);
+            }
+            mcts.reset();
+            mcts = std::make_unique<MonteCarloTreeSearch>(threads);
+            mcts->set_config(config_from_text(config_text));
+            mcts->set_env(env, obs_radius);
+            for(auto& e: mcts->penvs)
+            {
+                e.set_seed_salt(salt);
+            }
+            current_setup = setup;
+        }
+        return mcts->worker_search(positions, agent_idx, prev_actions, num_iterations);
+    });
+}
+
+bool MonteCarloTreeSearch::serve_if_worker()
+{
+    if (std::getenv(Workers::native_variable) == nullptr)
+    {
+        return false;
+    }
+    serve_search_worker();
+    _exit(0);
+}
+
+// an executable that links the search turns into a worker before main() when multi_process_search() starts it
+[[maybe_unused]] static const bool search_worker = MonteCarloTreeSearch::serve_if_worker();
+
+void MonteCarloTreeSearch::start_pondering()
+{
+    if (cfg.ponder_expansions <= 0 || cfg.decoupled_search || penvs[0].all_done())
+    {
+        return;
+    }
+    if (!ponder_thread.joinable())
+    {
+        ponder_thread = std::thread([this]{ ponder_worker(); });
+    }
+    {
+        const std::lock_guard<std::mutex> lock(ponder_mutex);
+        ponder_requested = true;
+        pondering = true;
+    }
+    ponder_cv.notify_all();
+}
+
+// returns once no pondering search runs or is about to start
+void MonteCarloTreeSearch::stop_pondering()
+{
+    std::unique_lock<std::mutex> lock(ponder_mutex);
+    if (pondering)
+    {
+        stop_search = true;
+        ponder_cv.wait(lock, [this]{ return !pondering; });
+    }
+    stop_search = false;
+}
+
+void MonteCarloTreeSearch::ponder_worker()
+{
+    std::unique_lock<std::mutex> lock(ponder_mutex);
+    while (true)
+    {
+        ponder_cv.wait(lock, [this]{ return ponder_requested || ponder_exit; });
+        if (ponder_exit)
+        {
+            return;
+        }
+        ponder_requested = false;
+        lock.unlock();
+        ponder();
+        lock.lock();
+        pondering = false;
+        ponder_cv.notify_all();
+    }
+}
+
+void MonteCarloTreeSearch::ponder()
+{
+    std::vector<int> actions;
+    try
+    {
+        if (cfg.batch_size <= 1 && cfg.num_parallel_trees > 1)
+        {
+            // the other trees are merged into the root by the search of the next act()
+            fork_join(cfg.num_parallel_trees, [this, &actions](const int i)
+            {
+                tree_parallelization_loop_internal(actions, i, cfg.ponder_expansions);
+            });
+        }
+        else
+        {
+            search(actions, cfg.ponder_expansions);
+        }
+    }
+    catch(const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+    }
+}
+
+void MonteCarloTreeSearch::sync_positions(const std::vector<std::pair<int, int>>& positions)
+{
+    const std::lock_guard<std::mutex> lock(act_mutex);
+    stop_pondering();
+    if (positions == penvs[0].cur_positions)
+    {
+        start_pondering();
+        return;
+    }
+    // the predicted subtree belongs to another state, searching restarts from fresh roots
+    for(auto& e: penvs)
+    {
+        e.set_positions(positions);
+    }
+    for(auto& tree: ptrees)
+    {
+        tree = safe_insert_node(nullptr, -1, 0, cfg.num_actions, 0);
+    }
+    root = ptrees[0];
+    droot = nullptr;
+    plan_cache.clear();
+    start_pondering();
+}
+
+std::vector<int> MonteCarloTreeSearch::decoupled_joint_action(DecoupledNode* n, const int process_num)
+{
+    const size_t num_agents = penvs[process_num].get_num_agents();
+    std::vector<int> actions(num_agents, 0);
+    const double log_cnt = std::log(std::max<uint64_t>(n->cnt, 1));
+    for(size_t agent_idx = 0; agent_idx < num_agents; agent_idx++)
+    {
+        if(penvs[process_num].reached_goal(agent_idx))
+        {
+            continue;
+        }
+        double best_score(-1000000);
+        for(int k = 0; k < cfg.num_actions; k++)
+        {
+            if (cfg.use_move_limits && !penvs[process_num].check_action(agent_idx, k, cfg.agents_as_obstacles))
+            {
+                continue;
+            }
+            const auto cnt = n->action_cnt[agent_idx * cfg.num_actions + k];
+            if (cnt == 0)
+            {
+                actions[agent_idx] = k;
+                break;
+            }
+            const double score = n->action_w[agent_idx * cfg.num_actions + k]/cnt + cfg.uct_c*std::sqrt(2.0*log_cnt/cnt);
+            if (score > best_score)
+            {
+                actions[agent_idx] = k;
+                best_score = score;
+            }
+        }
+    }
+    return actions;
+}
+
+double MonteCarloTreeSearch::decoupled_selection(DecoupledNode* n, const int process_num)
+{
+    const auto actions = decoupled_joint_action(n, process_num);
+    double score = penvs[process_num].step(actions);
+    if(!penvs[process_num].all_done())
+    {
+        auto child = n->child_nodes.find(actions);
+        if(child == n->child_nodes.end())
+        {
+            score += cfg.gamma*simulation(process_num);
+            n->child_nodes[actions] = safe_insert_decoupled_node(n);
+            num_expanded.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            score += cfg.gamma*decoupled_selection(child->second, process_num);
+        }
+    }
+    n->update_value(actions, score);
+    penvs[process_num].step_back();
+    return score;
+}
+
+DecoupledNode* MonteCarloTreeSearch::safe_insert_decoupled_node(DecoupledNode* parent)
+{
+    const std::lock_guard<std::mutex> lock(insert_mutex);
+    all_decoupled_nodes.emplace_back(parent, penvs[0].get_num_agents(), cfg.num_actions);
+    return &all_decoupled_nodes.back();
+}
+
+std::vector<int> MonteCarloTreeSearch::decoupled_act()
+{
+    if (droot == nullptr)
+    {
+        droot = safe_insert_decoupled_node(nullptr);
+    }
+    for (int i = 0; i < cfg.num_expansions; i++)
+    {
+        decoupled_selection(droot, 0);
+    }
+    std::vector<int> actions;
+    for(size_t agent_idx = 0; agent_idx < penvs[0].get_num_agents(); agent_idx++)
+    {
+        const int action = penvs[0].reached_goal(agent_idx) ? 0 : droot->get_action(agent_idx);
+        actions.push_back(std::max(action, 0));
+    }
+    auto child = droot->child_nodes.find(actions);
+    droot = (child == droot->child_nodes.end()) ? nullptr : child->second;
+    return actions;
+}
+
+int MonteCarloTreeSearch::forced_action(const int agent_idx) const
+{
+    const auto& env = penvs[0];
+    int legal_action(-1), num_legal(0);
+    for(int k = 0; k < cfg.num_actions; k++)
+    {
+        if(env.check_action(agent_idx, k, cfg.agents_as_obstacles))
+        {
+            legal_action = k;
+            num_legal++;
+        }
+    }
+    if(num_legal == 1)
+    {
+        return legal_action;
+    }
+    // stepping onto the goal is final and cannot be contested if no other agent is next to it
+    const auto position = env.cur_positions[agent_idx];
+    const auto goal = env.goals[agent_idx];
+    if(std::abs(position.first - goal.first) + std::abs(position.second - goal.second) != 1)
+    {
+        return -1;
+    }
+    for(size_t i = 0; i < env.get_num_agents(); i++)
+    {
+        const auto other = env.cur_positions[i];
+        if(static_cast<int>(i) != agent_idx && std::abs(other.first - goal.first) + std::abs(other.second - goal.second) <= 1)
+        {
+            return -1;
+        }
+    }
+    for(int k = 1; k < cfg.num_actions; k++)
+    {
+        if(position.first + env.moves[k].first == goal.first && position.second + env.moves[k].second == goal.second && env.check_action(agent_idx, k, cfg.agents_as_obstacles))
+        {
+            return k;
+        }
+    }
+    return -1;
+}
+
+void MonteCarloTreeSearch::triage(std::vector<int>& forced, std::vector<int>& budgets) const
+{
+    const auto& env = penvs[0];
+    const size_t num_agents = env.get_num_agents();
+    if(cfg.triage_forced_moves)
+    {
+        for(size_t i = 0; i < num_agents; i++)
+        {
+            if(!env.reached_goal(i))
+            {
+                forced[i] = forced_action(i);
+            }
+        }
+    }
+    if(cfg.step_budget <= 0)
+    {
+        return;
+    }
+    // contested agents share the step budget in proportion to their remaining distance and local congestion
+    std::vector<double> weights(num_agents, 0);
+    double total_weight(0);
+    for(size_t i = 0; i < num_agents; i++)
+    {
+        if(env.reached_goal(i) || forced[i] >= 0)
+        {
+            continue;
+        }
+        const auto position = env.cur_positions[i];
+        int congestion(0);
+        for(size_t j = 0; j < num_agents; j++)
+        {
+            const auto other = env.cur_positions[j];
+            if(j != i && std::abs(other.first - position.first) <= 2 && std::abs(other.second - position.second) <= 2)
+            {
+                congestion++;
+            }
+        }
+        const int distance = std::abs(position.first - env.goals[i].first) + std::abs(position.second - env.goals[i].second);
+        weights[i] = 1.0 + distance + congestion;
+        total_weight += weights[i];
+    }
+    for(size_t i = 0; i < num_agents; i++)
+    {
+        if(weights[i] > 0)
+        {
+            budgets[i] = std::max(1, static_cast<int>(std::lround(cfg.step_budget*weights[i]/total_weight)));
+        }
+    }
+}
+
+void MonteCarloTreeSearch::advance_roots(const int action, const int agent_idx)
+{
+    const int next_agent_idx = (agent_idx + 1) % penvs[0].get_num_agents();
+    for(int i = 0; i < cfg.num_parallel_trees; i++)
+    {
+        if(ptrees[i]->child_nodes[action] == nullptr)
+        {
+            ptrees[i]->child_nodes[action] = safe_insert_node(ptrees[i], action, 0, cfg.num_actions, next_agent_idx);
+        }
+        ptrees[i] = ptrees[i]->child_nodes[action];
+    }
+    root = ptrees[0];
+}
+
+ActHandle MonteCarloTreeSearch::act_async()
+{
+    async_acts.erase(std::remove_if(async_acts.begin(), async_acts.end(), [](const auto& pending)
+    {
+        return pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }), async_acts.end());
+    async_acts.push_back(std::async(std::launch::async, [this]{ return act(); }).share());
+    return ActHandle(async_acts.back());
+}
+
+std::vector<int> MonteCarloTreeSearch::act()
+{
+    // calls made without the GIL, or through act_async(), may overlap
+    const std::lock_guard<std::mutex> lock(act_mutex);
+    TRACE_SPAN("act");
+    stop_pondering();
+    std::vector<int> actions;
+    if (penvs[0].all_done())
+    {
+        for(size_t agent_idx = 0; agent_idx < penvs[0].get_num_agents(); agent_idx++)
+        {
+            actions.push_back(0);
+        }
+        return actions;
+    }
+    std::vector<char> action_names = {'S','U', 'D', 'L', 'R'};
+    std::vector<int> forced(penvs[0].get_num_agents(), -1);
+    std::vector<int> budgets(penvs[0].get_num_agents(), cfg.num_expansions);
+    if (!cfg.joint_search && !cfg.decoupled_search)
+    {
+        triage(forced, budgets);
+    }
+    for(size_t agent_idx = 0; agent_idx < penvs[0].get_num_agents() && !cfg.decoupled_search; agent_idx++)
+    {
+        if (cfg.collapse_finished_agents && cfg.batch_size <= 1 && agent_idx > 0 && penvs[0].reached_goal(agent_idx))
+        {
+            // selection skipped this agent's level, the roots already belong to the next agent
+            actions.push_back(0);
+            continue;
         }
+        try
+        {
+            // a joint search from the first agent's level already covers the decisions of all the others
+            const bool needs_search = cfg.joint_search ? agent_idx == 0 : !penvs[0].reached_goal(agent_idx) && forced[agent_idx] < 0;
+            if (needs_search && cfg.num_processes > 1)
+            {
+                multi_process_search(actions, budgets[agent_idx]);
+            }
+            else if (needs_search)
+            {
+                search(actions, budgets[agent_idx]);
+            }
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << e.what() << '\n';
+            std::cout<<"loop\n";
+        }
+
+        if (cfg.render)
+        {
+            std::cout<<agent_idx<<" "<<root->q<<" saved "<<iterations_saved.load()<<std::endl;
+            for(int i = 0; i < root->num_actions_; i++) {
+                int cnt = (root->child_nodes[i] == nullptr) ? 0 : root->child_nodes[i]->cnt;
+                std::cout << action_names[i] << ":" << cnt << " ";
+            }
+            std::cout<<std::endl;
+            for(int i = 0; i < root->num_actions_; i++) {
+                double c = (root->child_nodes[i] == nullptr) ? 0.0 : uct(root->child_nodes[i], agent_idx, 0);
+                std::cout << action_names[i] << ":" << c << " ";
+            }
+            std::cout<<std::endl;
+            std::cout<<"---------------------------------------------------------------------\n";
+        }
+        int action = (forced[agent_idx] >= 0) ? forced[agent_idx] : root->get_action();
+        if (action < 0)
+        {
+            action = 0;
+        }
+        advance_roots(action, agent_idx);
         actions.push_back(action);
     }
+    if (cfg.decoupled_search)
+    {
+        const uint64_t start = SearchCounters::now();
+        actions = decoupled_act();
+        counters.search_ns += SearchCounters::now() - start;
+    }
 
     for(int i = 0; i < num_envs; i++)
     {
         penvs[i].step(actions);
     }
+    plan_cache.clear();
     if (cfg.render)
     {
         for(auto a: actions)
             std::cout<<a<<" ";
         std::cout<<" actions\n";
     }
+    start_pondering();
     return actions;
 }
 
+BS::thread_pool& MonteCarloTreeSearch::thread_pool()
+{
+    const std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!pool)
+    {
+        pool = std::make_unique<BS::thread_pool>(pool_size);
+        if (applied_affinity != "none")
+            place_pool_threads();
+    }
+    return *pool;
+}
+
+WS::pool& MonteCarloTreeSearch::stealing_pool()
+{
+    const std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!ws_pool)
+    {
+        std::function<void(int)> pin;
+        if (applied_affinity != "none")
+        {
+            const auto cpus = Affinity::placement(applied_affinity, pool_size);
+            pin = [cpus](const int index){ Affinity::pin_current_thread(cpus[index]); };
+        }
+        ws_pool = std::make_unique<WS::pool>(pool_size, pin);
+    }
+    return *ws_pool;
+}
+
+// called with pool_mutex held
+void MonteCarloTreeSearch::place_pool_threads()
+{
+    const bool unpin = (applied_affinity == "none");
+    // every task waits until all of them started, so each pool thread pins or unpins itself exactly once
+    const int num_threads = pool->get_thread_count();
+    const auto cpus = unpin ? std::vector<Affinity::Cpu>() : Affinity::placement(applied_affinity, num_threads);
+    std::atomic<int> started(0);
+    std::vector<std::future<void>> futures;
+    for(int i = 0; i < num_threads; i++)
+    {
+        futures.push_back(pool->submit([this, &started, &cpus, unpin, num_threads]
+        {
+            const int index = started++;
+            if (unpin)
+                Affinity::unpin_current_thread(process_cpus);
+            else if (index < static_cast<int>(cpus.size()))
+                Affinity::pin_current_thread(cpus[index]);
+            while (started < num_threads)
+            {
+                std::this_thread::yield();
+            }
+        }));
+    }
+    for(auto& future: futures)
+    {
+        future.get();
+    }
+}
+
+void MonteCarloTreeSearch::apply_affinity()
+{
+    if (cfg.affinity == applied_affinity)
+    {
+        return;
+    }
+    const std::lock_guard<std::mutex> lock(pool_mutex);
+    applied_affinity = cfg.affinity;
+    if (pool)
+    {
+        place_pool_threads();
+    }
+    // rebuilt with the new placement when it is used next
+    ws_pool.reset();
+}
+
 void MonteCarloTreeSearch::set_config(const Config& config)
 {
+    // the selection kernels gather the children of a node into arrays of this size
+    if (config.num_actions < 1 || config.num_actions > UctKernel::max_children)
+        throw std::invalid_argument("num_actions must be between 1 and " + std::to_string(UctKernel::max_children));
+    const std::lock_guard<std::mutex> lock(act_mutex);
+    stop_pondering();
     cfg = config;
+    apply_affinity();
+    if (!cfg.work_stealing)
+    {
+        const std::lock_guard<std::mutex> lock(pool_mutex);
+        ws_pool.reset();
+    }
+    prepare_guidance();
 }
 
-void MonteCarloTreeSearch::set_env(Environment env, const int obs_radius_)
+void MonteCarloTreeSearch::set_env(const Environment& env, const int obs_radius_)
 {
+    const std::lock_guard<std::mutex> lock(act_mutex);
+    stop_pondering();
     for(int i = 0; i < cfg.num_parallel_trees; i++)
     {
         ptrees.push_back(safe_insert_node(nullptr, -1, 0, cfg.num_actions, 0));
     }
-    num_envs = std::max({cfg.num_parallel_trees, cfg.batch_size, cfg.multi_simulations});
+    num_search_envs = std::max({cfg.num_parallel_trees, cfg.batch_size, 1});
+    num_envs = (cfg.multi_simulations > 1) ? num_search_envs * (1 + cfg.multi_simulations) : num_search_envs;
     for(int i = 0; i < num_envs; i++)
     {
         penvs.push_back(env);
     }
+    descent_clocks.assign(num_envs, DescentClock());
+    amaf_moves.assign(num_envs, std::vector<std::vector<std::pair<std::pair<int, int>, int>>>(env.get_num_agents()));
     root = ptrees[0];
-    if (cfg.heuristic_coef > 0)
+    shortest_paths.clear();
+    priors = ActionPriors();
+    prepare_guidance();
+    obs_radius = obs_radius_;
+}
+
+// distance fields and priors depend only on the map and the goals, so the first config that needs them builds them
+void MonteCarloTreeSearch::prepare_guidance()
+{
+    if (penvs.empty())
     {
-        shortest_paths = bfs(env);
+        return;
+    }
+    if ((cfg.heuristic_coef > 0 || cfg.use_puct) && shortest_paths.empty())
+    {
+        shortest_paths = bfs(penvs[0]);
+    }
+    if (cfg.use_puct)
+    {
+        priors.init(shortest_paths, penvs[0].moves, cfg.num_actions, cfg.prior_temperature);
     }
-    obs_radius = obs_radius_;
 }
 
-std::vector<std::vector<std::vector<double>>> MonteCarloTreeSearch::bfs(Environment& env)
+std::vector<std::vector<std::vector<double>>> MonteCarloTreeSearch::bfs(const Environment& env)
 {
-    auto obstacles = env.grid;
+    const size_t height = env.grid.size();
+    const size_t width = (height > 0) ? env.grid[0].size() : 0;
 
-    std::vector<std::vector<std::vector<double>>> agents_map(env.num_agents, std::vector(obstacles.size(), std::vector<double>(obstacles.size())));
+    std::vector<std::vector<std::vector<double>>> agents_map;
     agents_map.reserve(env.num_agents);
 
     for(size_t i = 0; i < env.num_agents; i++)
     {
-        std::vector<std::vector<double>> filled(obstacles.size(), std::vector<double>(obstacles.size()));
-        for(size_t j = 0; j < filled.size(); j++)
-        {
-            for(size_t k = 0; k < filled[0].size(); k++)
-            {
-                if(obstacles[j][k] >= 0)
-                {
-                    filled[j].push_back(1000000);
-                }
-            }
-        }
+        std::vector<std::vector<double>> filled(height, std::vector<double>(width, 1000000));
         filled[env.goals[i].first][env.goals[i].second] = 0;
         std::deque<std::pair<int, int>> q;
         q.push_back(env.goals[i]);
@@ -492,8 +1802,8 @@ std::vector<std::vector<std::vector<double>>> MonteCarloTreeSearch::bfs(Environm
             q.pop_front();
             for(const auto& move: env.moves)
             {
-                if ((pos.first + move.first >= 0) && (static_cast<size_t>(pos.first + move.first) < filled.size())\
-                         && (pos.second + move.second >= 0) && (static_cast<size_t>(pos.second + move.second) < filled[0].size()))
+                if ((pos.first + move.first >= 0) && (static_cast<size_t>(pos.first + move.first) < height)\
+                         && (pos.second + move.second >= 0) && (static_cast<size_t>(pos.second + move.second) < width))
                 {
                     if ((filled[pos.first + move.first][pos.second + move.second] == 1000000) && env.grid[pos.first + move.first][pos.second + move.second] != 1)
                     {
@@ -503,17 +1813,54 @@ std::vector<std::vector<std::vector<double>>> MonteCarloTreeSearch::bfs(Environm
                 }
             }
         }
-        agents_map.push_back(filled);
+        agents_map.push_back(std::move(filled));
     }
     return agents_map;
 }
 
 PYBIND11_MODULE(mcts, m) {
+    m.def("enable_tracing", &Trace::set_enabled, py::arg("enabled") = true);
+    m.def("dump_trace", &Trace::dump, py::call_guard<py::gil_scoped_release>());
+    m.def("clear_trace", &Trace::clear);
+    m.def("_serve_worker", &MonteCarloTreeSearch::serve_search_worker, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<SearchStats>(m, "SearchStats")
+            .def_readonly("expansions", &SearchStats::expansions)
+            .def_readonly("rollouts", &SearchStats::rollouts)
+            .def_readonly("search_seconds", &SearchStats::search_seconds)
+            .def_readonly("expansions_per_second", &SearchStats::expansions_per_second)
+            .def_readonly("rollouts_per_second", &SearchStats::rollouts_per_second)
+            .def_readonly("selection_seconds", &SearchStats::selection_seconds)
+            .def_readonly("rollout_seconds", &SearchStats::rollout_seconds)
+            .def_readonly("backup_seconds", &SearchStats::backup_seconds)
+            .def_readonly("merge_seconds", &SearchStats::merge_seconds)
+            .def_readonly("insert_wait_seconds", &SearchStats::insert_wait_seconds)
+            .def_readonly("pool_wait_seconds", &SearchStats::pool_wait_seconds)
+            .def_readonly("num_nodes", &SearchStats::num_nodes)
+            .def_readonly("node_bytes", &SearchStats::node_bytes)
+            .def_readonly("max_depth", &SearchStats::max_depth)
+            .def_readonly("avg_depth", &SearchStats::avg_depth)
+            .def_readonly("rollout_lengths", &SearchStats::rollout_lengths)
+            ;
+
+    py::class_<ActHandle>(m, "ActHandle")
+            .def("done", &ActHandle::done)
+            .def("result", &ActHandle::result, py::call_guard<py::gil_scoped_release>())
+            ;
+
     py::class_<MonteCarloTreeSearch>(m, "MonteCarloTreeSearch")
             .def(py::init<>())
-            .def("act", &MonteCarloTreeSearch::act)
-            .def("set_config", &MonteCarloTreeSearch::set_config)
-            .def("set_env", &MonteCarloTreeSearch::set_env)
+            .def(py::init<int>())
+            .def("act", &MonteCarloTreeSearch::act, py::call_guard<py::gil_scoped_release>())
+            .def("act_async", &MonteCarloTreeSearch::act_async)
+            .def("set_config", &MonteCarloTreeSearch::set_config, py::call_guard<py::gil_scoped_release>())
+            .def("set_env", &MonteCarloTreeSearch::set_env, py::call_guard<py::gil_scoped_release>())
+            .def("sync_positions", &MonteCarloTreeSearch::sync_positions, py::call_guard<py::gil_scoped_release>())
+            .def("get_iterations_saved", &MonteCarloTreeSearch::get_iterations_saved)
+            .def("get_num_expanded", &MonteCarloTreeSearch::get_num_expanded)
+            .def("get_num_rollouts", &MonteCarloTreeSearch::get_num_rollouts)
+            .def("get_stats", &MonteCarloTreeSearch::get_stats, py::call_guard<py::gil_scoped_release>())
+            .def("reset_stats", &MonteCarloTreeSearch::reset_stats, py::call_guard<py::gil_scoped_release>())
             ;
 }
 
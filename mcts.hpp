@@ -3,6 +3,8 @@
     #include "omp.h"
 #endif
 #include "BS_thread_pool.hpp"
+#include "work_stealing_pool.hpp"
+#include "affinity.hpp"
 #include <iostream>
 #include <list>
 #include <vector>
@@ -11,34 +13,129 @@
 #include <string>
 #include <chrono>
 #include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include <future>
 #include "config.cpp"
 #include "node.hpp"
 #include "replan.cpp"
+#include "action_priors.hpp"
+#include "search_stats.hpp"
+#include "worker_processes.hpp"
+
+// Pending result of MonteCarloTreeSearch::act_async()
+class ActHandle
+{
+    std::shared_future<std::vector<int>> future;
+public:
+    explicit ActHandle(std::shared_future<std::vector<int>> future_) : future(std::move(future_)) {}
+
+    bool done() const
+    {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    std::vector<int> result() const
+    {
+        return future.get();
+    }
+};
 
 class MonteCarloTreeSearch
 {
+    struct NodeStorage
+    {
+        std::mutex mutex;
+        std::list<Node> nodes;
+    };
+
     Node* root;
-    std::list<Node> all_nodes;
+    NodeStorage all_nodes;
+    std::list<DecoupledNode> all_decoupled_nodes;
+    DecoupledNode* droot = nullptr;
     std::list<Environment> all_envs;
     Config cfg;
-    BS::thread_pool pool;
+    // created on first use by thread_pool() and stealing_pool(), so sequential searches start no threads
+    int pool_size;
+    std::mutex pool_mutex;
+    std::unique_ptr<BS::thread_pool> pool;
+    std::unique_ptr<WS::pool> ws_pool;
     std::vector<Node*> ptrees;
     std::vector<Environment> penvs;
+    std::string applied_affinity = "none";
+    // CPUs of the constructing thread, where pool threads go back to when affinity returns to "none"
+    std::vector<int> process_cpus;
     int num_envs;
+    int num_search_envs;
     std::vector<std::vector<std::vector<double>>> shortest_paths;
+    ActionPriors priors;
+    std::vector<std::vector<std::vector<std::pair<std::pair<int, int>, int>>>> amaf_moves;
     int obs_radius;
+    PlanCache plan_cache;
+    // one pondering thread for the planner's lifetime, woken for every search between act() calls
+    std::thread ponder_thread;
+    std::mutex ponder_mutex;
+    std::condition_variable ponder_cv;
+    bool ponder_requested = false;
+    bool pondering = false;
+    bool ponder_exit = false;
+    std::atomic<bool> stop_search{false};
+    std::atomic<uint64_t> iterations_saved{0};
+    std::atomic<uint64_t> num_expanded{0};
+    std::atomic<uint64_t> num_rollouts{0};
+    std::atomic<uint64_t> seeded_rollouts{0};
+    // running totals of the node storage, kept by safe_insert_node() and clear_trees()
+    std::atomic<uint64_t> num_nodes{0};
+    std::atomic<uint64_t> node_bytes{0};
+    SearchCounters counters;
+    std::vector<DescentClock> descent_clocks;
+    std::mutex act_mutex;
+    std::vector<std::shared_future<std::vector<int>>> async_acts;
+    std::vector<std::unique_ptr<Workers::Process>> workers;
+    uint64_t worker_jobs = 0;
 public:
     Environment env;
 
-    explicit MonteCarloTreeSearch();
+    // num_threads sizes the search pool, 0 uses every hardware thread
+    explicit MonteCarloTreeSearch(const int num_threads = 0);
+
+    ~MonteCarloTreeSearch();
 
     std::vector<int> act();
 
-    void set_env(Environment env_, const int obs_radius_);
+    ActHandle act_async();
+
+    void set_env(const Environment& env_, const int obs_radius_);
 
     void set_config(const Config& config);
 
+    void sync_positions(const std::vector<std::pair<int, int>>& positions);
+
+    uint64_t get_iterations_saved() const;
+
+    uint64_t get_num_expanded() const;
+
+    uint64_t get_num_rollouts() const;
+
+    SearchStats get_stats();
+
+    void reset_stats();
+
+    // answers search jobs of a coordinator until it goes away, in a process started by multi_process_search()
+    static void serve_search_worker();
+
+    static bool serve_if_worker();
+
 protected:
+    template<typename F>
+    void fork_join(const int num_tasks, F&& f);
+
+    uint64_t node_footprint(const int num_actions) const;
+
     Node* safe_insert_node(Node* n, const int action, const double score, const int num_actions, const int next_agent_idx);
 
     double single_simulation(const int process_num);
@@ -47,27 +144,93 @@ protected:
 
     double uct(Node* n, const int agent_idx, const int process_num) const;
 
-    double batch_uct(Node* n) const;
+    double distance_gain(const int agent_idx, const std::pair<int, int> position, const int action) const;
 
     int expansion(Node* n, const int agent_idx, const int process_num) const;
 
+    int puct_expansion(Node* n, const int agent_idx, const int process_num) const;
+
+    bool rave_enabled() const;
+
+    void reset_amaf(const int process_num);
+
+    void update_amaf(Node* n, const int agent_idx, const int action, const int process_num, const double score);
+
+    double child_value(const Node* n, const Node* c, const int action) const;
+
     double selection(Node* n, std::vector<int> actions, const int process_num);
 
+    void begin_descent(const int process_num);
+
+    void end_descent(const int process_num);
+
     int select_action_for_batch_path(Node* n, const int agent_idx, const int process_num);
 
-    std::vector<int> batch_selection(Node* n, std::vector<int> actions, const int process_num);
+    std::vector<int> batch_selection(Node* n, std::vector<int> actions, const int process_num, Node** leaf);
+
+    void release_virtual_loss(Node* n);
+
+    BS::thread_pool& thread_pool();
+
+    WS::pool& stealing_pool();
+
+    void place_pool_threads();
+
+    void apply_affinity();
 
     double batch_expansion(std::vector<int> path_actions, std::vector<int> prev_actions, const int process_num);
 
-    void loop(std::vector<int>& prev_actions);
+    void loop(std::vector<int>& prev_actions, const int num_iterations);
+
+    std::vector<int> child_widths() const;
+
+    void batch_loop(std::vector<int>& prev_actions, const int num_iterations);
 
-    void batch_loop(std::vector<int>& prev_actions);
+    void pipelined_batch_loop(std::vector<int>& prev_actions, const int num_iterations);
 
     void retrieve_statistics(Node* tree, Node* from_root);
 
-    void tree_parallelization_loop_internal(std::vector<int> prev_actions, const int process_num);
+    void tree_parallelization_loop_internal(std::vector<int> prev_actions, const int process_num, const int num_iterations);
+
+    void tree_parallelization_loop(std::vector<int>& prev_actions, const int num_iterations);
+
+    Node* tree(const int tree_idx) const;
+
+    bool decided(const Node* n, const uint64_t remaining) const;
+
+    bool decided_level(const Node* n, const uint64_t remaining) const;
+
+    void search(std::vector<int>& prev_actions, const int num_iterations);
+
+    void multi_process_search(std::vector<int>& prev_actions, const int num_iterations);
+
+    void clear_trees(const int agent_idx);
+
+    std::string worker_search(const std::vector<int>& positions, const int agent_idx, std::vector<int>& prev_actions, const int num_iterations);
+
+    void start_pondering();
+
+    void stop_pondering();
+
+    void ponder_worker();
+
+    void ponder();
+
+    void advance_roots(const int action, const int agent_idx);
+
+    int forced_action(const int agent_idx) const;
+
+    void triage(std::vector<int>& forced, std::vector<int>& budgets) const;
+
+    DecoupledNode* safe_insert_decoupled_node(DecoupledNode* parent);
+
+    std::vector<int> decoupled_joint_action(DecoupledNode* n, const int process_num);
+
+    double decoupled_selection(DecoupledNode* n, const int process_num);
+
+    std::vector<int> decoupled_act();
 
-    void tree_parallelization_loop(std::vector<int>& prev_actions);
+    void prepare_guidance();
 
-    std::vector<std::vector<std::vector<double>>> bfs(Environment& env);
+    std::vector<std::vector<std::vector<double>>> bfs(const Environment& env);
 };
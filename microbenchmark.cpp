@@ -0,0 +1,362 @@
+#include "mcts.cpp"
+#include "map_generator.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Times the hot kernels one by one on generated maps and prints the results as JSON. Usage:
+//   microbenchmark [--kernels step,bfs,...] [--agents 4,16] [--sizes 16,32] [--densities 0.1,0.3]
+//                  [--threads 1,4] [--seed S] [--min-time seconds]
+// With t threads, t workers run the kernel concurrently, each on its own copy of the state, so the sweep
+// shows how a kernel scales when every search thread runs it at once.
+
+// exposes the protected parts of the search to the benchmark
+class SearchProbe : public MonteCarloTreeSearch
+{
+public:
+    explicit SearchProbe(const Config& config) : MonteCarloTreeSearch(1)
+    {
+        set_config(config);
+    }
+
+    void descend(const int tree_idx)
+    {
+        const double score = selection(tree(tree_idx), {}, tree_idx);
+        tree(tree_idx)->update_value(score);
+    }
+
+    void merge(const int tree_idx)
+    {
+        retrieve_statistics(tree(tree_idx), tree(0));
+    }
+
+    void reset()
+    {
+        clear_trees(0);
+    }
+
+    std::vector<std::vector<std::vector<double>>> distances(const Environment& env)
+    {
+        return bfs(env);
+    }
+};
+
+struct Case
+{
+    int agents;
+    int size;
+    double density;
+    int threads;
+    int seed;
+};
+
+// the operation a worker repeats; reset, if set, runs untimed after every reset_every operations
+struct Kernel
+{
+    std::function<void()> op;
+    std::function<void()> reset;
+    uint64_t reset_every = 0;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Kernel>>>
+    Kernel(F f) : op(std::move(f))
+    {}
+
+    Kernel(std::function<void()> op_, std::function<void()> reset_, const uint64_t reset_every_)
+        : op(std::move(op_)), reset(std::move(reset_)), reset_every(reset_every_)
+    {}
+};
+
+struct Measurement
+{
+    uint64_t ops = 0;
+    double ns_per_op = 0;
+    double ops_per_sec = 0;
+};
+
+// every worker builds its kernel first, then all of them run it until min_seconds have passed
+Measurement measure(const int threads, const std::function<Kernel(int)>& make_kernel, const double min_seconds)
+{
+    std::vector<uint64_t> ops(threads, 0);
+    std::vector<double> seconds(threads, 0);
+    std::atomic<int> ready(0);
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]
+        {
+            auto kernel = make_kernel(t);
+            kernel.op();
+            uint64_t since_reset(1);
+            ready++;
+            while (ready < threads)
+            {
+                std::this_thread::yield();
+            }
+            double elapsed(0);
+            do
+            {
+                if (kernel.reset_every > 0 && since_reset >= kernel.reset_every)
+                {
+                    kernel.reset();
+                    since_reset = 0;
+                }
+                const auto start = std::chrono::steady_clock::now();
+                for(int i = 0; i < 16; i++)
+                {
+                    kernel.op();
+                }
+                ops[t] += 16;
+                since_reset += 16;
+                elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (elapsed < min_seconds);
+            seconds[t] = elapsed;
+        });
+    }
+    for(auto& worker: workers)
+    {
+        worker.join();
+    }
+    Measurement result;
+    double latency(0), longest(0);
+    for(int t = 0; t < threads; t++)
+    {
+        result.ops += ops[t];
+        latency += seconds[t] * 1e9 / ops[t];
+        longest = std::max(longest, seconds[t]);
+    }
+    result.ns_per_op = latency / threads;
+    result.ops_per_sec = result.ops / longest;
+    return result;
+}
+
+Environment make_env(const Case& c, std::vector<std::pair<int, int>>& obstacles)
+{
+    MapSpec spec;
+    spec.size = c.size;
+    spec.density = c.density;
+    spec.num_agents = c.agents;
+    spec.seed = c.seed;
+    const auto map = generate_map(spec);
+    Environment env;
+    env.create_grid(c.size, c.size);
+    for(int i = 0; i < c.size; i++)
+    {
+        for(int j = 0; j < c.size; j++)
+        {
+            if (map.obstacles[i][j])
+            {
+                env.add_obstacle(i, j);
+                obstacles.emplace_back(i, j);
+            }
+        }
+    }
+    for(size_t k = 0; k < map.starts.size(); k++)
+    {
+        env.add_agent(map.starts[k].first, map.starts[k].second, map.goals[k].first, map.goals[k].second);
+    }
+    env.set_seed(c.seed);
+    return env;
+}
+
+// per kernel, a factory of the operation one worker repeats
+std::map<std::string, std::function<Kernel(const Environment&, const std::vector<std::pair<int, int>>&, int)>> kernels()
+{
+    static std::atomic<uint64_t> sink(0);
+    const int rollout_steps = 16;
+    const int tree_size = 2000;
+    return {
+        {"step", [](const Environment& env, const std::vector<std::pair<int, int>>&, int)
+        {
+            // a step with actions from the rollout policy, undone again as at the end of a rollout
+            auto e = std::make_shared<Environment>(env);
+            auto actions = std::make_shared<std::vector<int>>(e->sample_actions(Config().num_actions, true));
+            return [e, actions]
+            {
+                e->step(*actions);
+                e->step_back();
+            };
+        }},
+        {"check_action", [](const Environment& env, const std::vector<std::pair<int, int>>&, int)
+        {
+            auto e = std::make_shared<Environment>(env);
+            return [e]
+            {
+                int valid(0);
+                for(size_t i = 0; i < e->get_num_agents(); i++)
+                    for(int a = 0; a < Config().num_actions; a++)
+                        valid += e->check_action(i, a, true);
+                sink += valid;
+            };
+        }},
+        {"sample_actions", [](const Environment& env, const std::vector<std::pair<int, int>>&, int)
+        {
+            auto e = std::make_shared<Environment>(env);
+            const Config cfg;
+            return [e, cfg]
+            {
+                sink += e->sample_actions(cfg.num_actions, cfg.use_move_limits, cfg.agents_as_obstacles).size();
+            };
+        }},
+        {"update_path", [](const Environment& env, const std::vector<std::pair<int, int>>& obstacles, int)
+        {
+            // every agent's full A* search on the known map
+            auto p = std::make_shared<planner>();
+            p->set_bounds(env.grid.size(), env.grid[0].size());
+            p->update_obstacles({obstacles.begin(), obstacles.end()}, {}, {0, 0});
+            const auto starts = env.cur_positions;
+            const auto goals = env.goals;
+            auto next = std::make_shared<size_t>(0);
+            return [p, starts, goals, next]
+            {
+                const size_t k = (*next)++ % starts.size();
+                p->update_path(starts[k], goals[k]);
+            };
+        }},
+        {"replan_act", [rollout_steps](const Environment& env, const std::vector<std::pair<int, int>>&, const int worker)
+        {
+            // one RePlan step; a fresh planner every rollout_steps calls, as single_simulation() builds one per rollout
+            auto replan = std::make_shared<RePlan>();
+            auto calls = std::make_shared<int>(0);
+            return [env, rollout_steps, worker, replan, calls]
+            {
+                if ((*calls)++ % rollout_steps == 0)
+                {
+                    *replan = RePlan();
+                    replan->init(env.get_num_agents(), 5, true, 0.2, true, 10000000, worker, false);
+                    replan->set_env(env);
+                }
+                sink += replan->act().size();
+            };
+        }},
+        {"bfs", [](const Environment& env, const std::vector<std::pair<int, int>>&, int)
+        {
+            auto probe = std::make_shared<SearchProbe>(Config());
+            return [probe, env]
+            {
+                sink += probe->distances(env).size();
+            };
+        }},
+        {"selection", [tree_size](const Environment& env, const std::vector<std::pair<int, int>>&, int)
+        {
+            // descent with a zero-length rollout, so the tree walk and node inserts dominate; the tree starts
+            // over every tree_size descents, so the measured depth does not depend on how long the kernel ran
+            Config cfg;
+            cfg.render = false;
+            cfg.steps_limit = 0;
+            auto probe = std::make_shared<SearchProbe>(cfg);
+            probe->set_env(env, 5);
+            return Kernel([probe] { probe->descend(0); }, [probe] { probe->reset(); }, tree_size);
+        }},
+        {"retrieve_statistics", [tree_size](const Environment& env, const std::vector<std::pair<int, int>>&, int)
+        {
+            // merge of a tree_size tree into the root, as after every tree-parallel search
+            Config cfg;
+            cfg.render = false;
+            cfg.steps_limit = 0;
+            cfg.num_parallel_trees = 2;
+            auto probe = std::make_shared<SearchProbe>(cfg);
+            probe->set_env(env, 5);
+            for(int i = 0; i < tree_size; i++)
+                probe->descend(1);
+            return [probe]
+            {
+                probe->merge(1);
+            };
+        }},
+    };
+}
+
+template<typename T>
+std::vector<T> parse_values(const std::string& text)
+{
+    std::vector<T> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        std::stringstream value(item);
+        T v;
+        value >> v;
+        values.push_back(v);
+    }
+    return values;
+}
+
+int main(int argc, char* argv[])
+{
+    auto all_kernels = kernels();
+    std::vector<std::string> names;
+    for(const auto& kernel: all_kernels)
+        names.push_back(kernel.first);
+    std::vector<int> agents = {4, 16}, sizes = {16, 32}, threads = {1};
+    std::vector<double> densities = {0.3};
+    int seed(0);
+    double min_time(0.2);
+    for(int i = 1; i + 1 < argc; i += 2)
+    {
+        const std::string key = argv[i];
+        const std::string value = argv[i + 1];
+        if (key == "--kernels") names = parse_values<std::string>(value);
+        else if (key == "--agents") agents = parse_values<int>(value);
+        else if (key == "--sizes") sizes = parse_values<int>(value);
+        else if (key == "--densities") densities = parse_values<double>(value);
+        else if (key == "--threads") threads = parse_values<int>(value);
+        else if (key == "--seed") seed = std::stoi(value);
+        else if (key == "--min-time") min_time = std::stod(value);
+        else
+        {
+            std::cerr << "unknown option " << key << std::endl;
+            return 1;
+        }
+    }
+    for(const auto& name: names)
+    {
+        if (!all_kernels.count(name))
+        {
+            std::cerr << "unknown kernel " << name << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+              << ",\n  \"min_time\": " << min_time << ",\n  \"results\": [";
+    bool first(true);
+    for(const auto& name: names)
+    {
+        for(const int size: sizes)
+        {
+            for(const double density: densities)
+            {
+                for(const int num_agents: agents)
+                {
+                    for(const int num_threads: threads)
+                    {
+                        const Case c = {num_agents, size, density, num_threads, seed};
+                        std::vector<std::pair<int, int>> obstacles;
+                        const Environment env = make_env(c, obstacles);
+                        if (env.get_num_agents() == 0)
+                            continue;
+                        const auto& make = all_kernels.at(name);
+                        const auto m = measure(num_threads, [&](const int worker) { return make(env, obstacles, worker); }, min_time);
+                        std::cout << (first ? "\n" : ",\n") << "    {\"kernel\": \"" << name << "\", \"size\": " << size
+                                  << ", \"density\": " << density << ", \"agents\": " << env.get_num_agents()
+                                  << ", \"threads\": " << num_threads << ", \"ops\": " << m.ops
+                                  << ", \"ns_per_op\": " << m.ns_per_op << ", \"ops_per_sec\": " << m.ops_per_sec << "}";
+                        std::cout.flush();
+                        first = false;
+                    }
+                }
+            }
+        }
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <list>
+#include <map>
 #include <vector>
 
 class Node
@@ -14,6 +15,8 @@ public:
     uint64_t cnt_sne;
     std::vector<bool> mask_picked;
     int num_actions_;
+    std::vector<uint32_t> rave_cnt;
+    std::vector<double> rave_w;
 
     Node(Node* _parent, int _action_id, double _w, int num_actions, int _agent_id=-1)
             : action_id(_action_id), parent(_parent), w(_w), agent_id(_agent_id)
@@ -32,6 +35,24 @@ public:
         q = w/cnt;
     }
 
+    // all-moves-as-first: value of every action in actions_mask that the agent played here or later in the simulation
+    void update_rave(uint32_t actions_mask, double value)
+    {
+        if (rave_cnt.empty())
+        {
+            rave_cnt.resize(num_actions_, 0);
+            rave_w.resize(num_actions_, 0);
+        }
+        for(int k = 0; k < num_actions_; k++)
+        {
+            if ((actions_mask >> k) & 1)
+            {
+                rave_cnt[k]++;
+                rave_w[k] += value;
+            }
+        }
+    }
+
     void update_value_batch(double value)
     {
         w += value;
@@ -43,7 +64,7 @@ public:
         }
     }
 
-    int get_action()
+    int get_action() const
     {
         int best_action(0), k(0);
         uint64_t best_score = 0;
@@ -59,7 +80,7 @@ public:
             }
             k++;
         }
-        while((child_nodes[best_action] == nullptr) && (best_action < num_actions_))
+        while((best_action < num_actions_) && (child_nodes[best_action] == nullptr))
         {
             best_action++;
         }
@@ -99,3 +120,46 @@ public:
         }
     }
 };
+
+
+// Node of the decoupled search: one node per joint state, with separate action statistics for every agent.
+// Children are keyed by the joint action that was taken, so the depth equals the planning horizon.
+class DecoupledNode
+{
+public:
+    DecoupledNode* parent;
+    uint64_t cnt;
+    std::vector<uint64_t> action_cnt;
+    std::vector<double> action_w;
+    std::map<std::vector<int>, DecoupledNode*> child_nodes;
+    int num_actions_;
+
+    DecoupledNode(DecoupledNode* _parent, int num_agents, int num_actions)
+            : parent(_parent), cnt(0), action_cnt(num_agents * num_actions, 0), action_w(num_agents * num_actions, 0), num_actions_(num_actions)
+    {}
+
+    void update_value(const std::vector<int>& actions, double value)
+    {
+        cnt++;
+        for(size_t agent_idx = 0; agent_idx < actions.size(); agent_idx++)
+        {
+            action_cnt[agent_idx * num_actions_ + actions[agent_idx]]++;
+            action_w[agent_idx * num_actions_ + actions[agent_idx]] += value;
+        }
+    }
+
+    int get_action(int agent_idx) const
+    {
+        int best_action(-1);
+        uint64_t best_score = 0;
+        for(int k = 0; k < num_actions_; k++)
+        {
+            if(action_cnt[agent_idx * num_actions_ + k] > best_score)
+            {
+                best_action = k;
+                best_score = action_cnt[agent_idx * num_actions_ + k];
+            }
+        }
+        return best_action;
+    }
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <utility>
+#include <unordered_map>
+
+inline uint64_t mix_hash(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline uint64_t hash_cell(const std::pair<int, int>& cell)
+{
+    return mix_hash((uint64_t(uint32_t(cell.first)) << 32) | uint32_t(cell.second));
+}
+
+struct PlanKey
+{
+    std::pair<int, int> position;
+    std::pair<int, int> goal;
+    uint64_t agents_hash;
+
+    bool operator==(const PlanKey& other) const
+    {
+        return position == other.position && goal == other.goal && agents_hash == other.agents_hash;
+    }
+};
+
+struct PlanKeyHash
+{
+    size_t operator()(const PlanKey& key) const
+    {
+        return mix_hash(hash_cell(key.position) ^ (hash_cell(key.goal) * 31) ^ key.agents_hash);
+    }
+};
+
+// Next move chosen by a planner for a given position, goal and configuration of visible agents.
+// Shared by all rollouts and workers of one search; it has to be cleared whenever the root state changes.
+class PlanCache
+{
+    static constexpr size_t num_shards = 64;
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<PlanKey, int, PlanKeyHash> entries;
+    };
+    std::array<Shard, num_shards> shards;
+
+    Shard& shard(const PlanKey& key)
+    {
+        return shards[PlanKeyHash()(key) % num_shards];
+    }
+public:
+    bool find(const PlanKey& key, int& action)
+    {
+        auto& s = shard(key);
+        const std::lock_guard<std::mutex> lock(s.mutex);
+        const auto it = s.entries.find(key);
+        if(it == s.entries.end())
+            return false;
+        action = it->second;
+        return true;
+    }
+
+    void insert(const PlanKey& key, const int action)
+    {
+        auto& s = shard(key);
+        const std::lock_guard<std::mutex> lock(s.mutex);
+        s.entries.emplace(key, action);
+    }
+
+    void clear()
+    {
+        for(auto& s: shards)
+        {
+            const std::lock_guard<std::mutex> lock(s.mutex);
+            s.entries.clear();
+        }
+    }
+};
@@ -8,6 +8,7 @@
 #include <set>
 #include <map>
 #include <list>
+#include "trace.hpp"
 #define INF 1000000000
 namespace py = pybind11;
 
@@ -49,10 +50,12 @@ class planner {
     std::priority_queue<PlannerNode, std::vector<PlannerNode>, std::greater<PlannerNode>> OPEN;
     std::map<std::pair<int, int>, std::pair<int, int>> CLOSED;
     std::pair<int, int> start;
-    std::pair<int, int> desired_position;
+    std::pair<int, int> desired_position = {INF, INF};
     std::pair<int, int> goal;
     PlannerNode best_node;
     int max_steps;
+    int height = INF;
+    int width = INF;
     inline int h(std::pair<int, int> n)
     {
         return std::abs(n.first - goal.first) + std::abs(n.second - goal.second);
@@ -64,6 +67,8 @@ class planner {
         for(auto d:deltas)
         {
             std::pair<int,int> n(node.first + d.first, node.second + d.second);
+            if(n.first < 0 or n.second < 0 or n.first >= height or n.second >= width)
+                continue;
             if(obstacles.count(n) == 0)
                 neighbors.push_back(n);
         }
@@ -98,6 +103,11 @@ class planner {
     }
 public:
     planner(int steps=10000) {max_steps = steps;}
+    void set_bounds(int _height, int _width)
+    {
+        height = _height;
+        width = _width;
+    }
     void update_obstacles(const std::list<std::pair<int, int>>& _obstacles,
                           const std::list<std::pair<int, int>>& _other_agents,
                           std::pair<int, int> cur_pos)
@@ -108,7 +118,7 @@ public:
         for(auto o:_other_agents)
             other_agents.insert({cur_pos.first + o.first, cur_pos.second + o.second});
     }
-    void update_path(std::pair<int, int> s, std::pair<int, int> g)
+    void update_start(std::pair<int, int> s)
     {
         if(desired_position.first < INF and (desired_position.first != s.first or desired_position.second != s.second)) {
             bad_actions.insert(desired_position);
@@ -119,10 +129,28 @@ public:
         else
             bad_actions.clear();
         start = s;
+    }
+    void search(std::pair<int, int> g)
+    {
+        TRACE_SPAN("planner::search");
         goal = g;
         reset();
         compute_shortest_path();
     }
+    void update_path(std::pair<int, int> s, std::pair<int, int> g)
+    {
+        update_start(s);
+        search(g);
+    }
+    bool has_bad_actions() const
+    {
+        return !bad_actions.empty();
+    }
+    // used when the next move is taken from elsewhere (e.g. a cache) instead of get_next_node
+    void set_desired_position(std::pair<int, int> p)
+    {
+        desired_position = p;
+    }
     std::list<std::pair<int, int>> get_path(bool use_best_node = true)
     {
         std::list<std::pair<int, int>> path;
@@ -164,6 +192,7 @@ public:
 PYBIND11_MODULE(planner, m) {
     py::class_<planner>(m, "planner")
             .def(py::init<int>())
+            .def("set_bounds", &planner::set_bounds)
             .def("update_obstacles", &planner::update_obstacles)
             .def("update_path", &planner::update_path)
             .def("get_path", &planner::get_path)
@@ -4,6 +4,11 @@
 #include <pybind11/stl_bind.h>
 #include "planner.cpp"
 #include "environment.cpp"
+#include "local_view.hpp"
+#include "ring_buffer.hpp"
+#include "spatial_hash.hpp"
+#include "plan_cache.hpp"
+#include "BS_thread_pool.hpp"
 #include <mutex>
 #include <deque>
 #include <utility>
@@ -25,9 +30,14 @@ class RePlan
     int seed;
     bool ignore_other_agents = false;
     std::vector<planner> planners;
-    std::vector<std::vector<std::pair<int, int>>> previous_positions;
+    std::vector<RingBuffer<std::pair<int, int>, 2>> previous_positions;
+    LocalView local_view;
+    SpatialHash agents_hash;
     std::default_random_engine engine;
     Environment env;
+    BS::thread_pool* pool = nullptr;
+    std::shared_ptr<BS::thread_pool> own_pool;
+    PlanCache* plan_cache = nullptr;
 
 public:
 
@@ -53,11 +63,7 @@ public:
         {
             planners.push_back(planner(max_steps));
         }
-        previous_positions.reserve(num_agents);
-        for(int i = 0; i < num_agents; i++)
-        {
-            previous_positions.push_back({});
-        }
+        previous_positions.assign(num_agents, {});
     }
 
     int _get_random_move(const int agent_idx, const Environment& env)
@@ -69,73 +75,74 @@ public:
         return to_shuffle[0];
     }
 
-    std::vector<int> act()
+    int plan_agent(const int i)
     {
-        std::vector<int> actions;
-        for(int i = 0; i < num_agents; i++)
+        previous_positions[i].push(env.cur_positions[i]);
+        if (env.reached_goal(i))
         {
-            if (previous_positions.size() == 0)
-            {
-                std::vector<std::pair<int, int>> positions;
-                positions.push_back(env.cur_positions[i]);
-                previous_positions.push_back(positions);
-            }
-            else
-            {
-                previous_positions[i].push_back(env.cur_positions[i]);
-            }
-            if (env.reached_goal(i))
-            {
-                actions.push_back(0);
-            }
-            else
+            return 0;
+        }
+        std::list<std::pair<int, int>> visible_obstacles;
+        local_view.new_obstacles(i, env.cur_positions[i], obs_radius, visible_obstacles);
+        std::list<std::pair<int, int>> visible_agents;
+        uint64_t agents_hash_value = 0;
+        if (!ignore_other_agents)
+        {
+            agents_hash.for_each_within(env.cur_positions[i], obs_radius, [&](const int j, const std::pair<int, int>& pos)
             {
-                std::list<std::pair<int, int>> visible_obstacles;
-                for(int m = env.cur_positions[i].first - obs_radius; m <= env.cur_positions[i].first + obs_radius; m++) // absence of oob guaranteed by pogema
-                {
-                    for(int n = env.cur_positions[i].second - obs_radius; n <= env.cur_positions[i].second + obs_radius; n++)
-                    {
-                        if (env.grid[m][n] == OBSTACLE)
-                        {
-                            visible_obstacles.push_back(std::make_pair(m - env.cur_positions[i].first + obs_radius,n - env.cur_positions[i].second + obs_radius));
-                        }
-                    }
-                }
-                std::list<std::pair<int, int>> visible_agents;
-                if (!ignore_other_agents)
-                {
-                    for (int j = 0; j < num_agents; j++)
-                    {
-                        if (i != j)
-                        {
-                            if ((std::abs(env.cur_positions[i].first - env.cur_positions[j].first) <= obs_radius) && (std::abs(env.cur_positions[i].second - env.cur_positions[j].second) <= obs_radius))
-                            {
-                                visible_agents.push_back(std::make_pair(env.cur_positions[j].first - env.cur_positions[i].first + obs_radius, env.cur_positions[j].second - env.cur_positions[i].second + obs_radius));
-                            }
-                        }
-                    }
-                }
-                planners[i].update_obstacles(visible_obstacles, visible_agents, std::make_pair(env.cur_positions[i].first - obs_radius, env.cur_positions[i].second - obs_radius));
-                // if (skip_agents.size() > 0)
-                // {
-                //     if(std::find(skip_agents.begin(), skip_agents.end(), i) != skip_agents.end())
-                //     {
-                //         actions.push_back(0);
-                //         continue;
-                //     }
-                // }
-                planners[i].update_path(env.cur_positions[i], env.goals[i]);
-                auto path = planners[i].get_next_node(use_best_move);
-                if (path.second.first < INF)
+                if (i != j)
                 {
-                    const auto action = std::make_pair(path.second.first - path.first.first, path.second.second - path.first.second);
-                    const auto action_index = std::find(moves.begin(), moves.end(), action) - moves.begin();
-                    actions.push_back(action_index);
+                    visible_agents.push_back(std::make_pair(pos.first - env.cur_positions[i].first + obs_radius, pos.second - env.cur_positions[i].second + obs_radius));
+                    agents_hash_value += hash_cell(visible_agents.back());
                 }
-                else
+            });
+        }
+        planners[i].update_obstacles(visible_obstacles, visible_agents, std::make_pair(env.cur_positions[i].first - obs_radius, env.cur_positions[i].second - obs_radius));
+        planners[i].update_start(env.cur_positions[i]);
+        // a planner that is avoiding its own failed moves is in a situation the cache does not describe
+        const bool use_cache = plan_cache != nullptr && !planners[i].has_bad_actions();
+        const PlanKey key = {env.cur_positions[i], env.goals[i], agents_hash_value};
+        int action(0);
+        if (use_cache && plan_cache->find(key, action))
+        {
+            const auto move = moves[action];
+            planners[i].set_desired_position(action == 0 ? std::make_pair(INF, INF) : std::make_pair(env.cur_positions[i].first + move.first, env.cur_positions[i].second + move.second));
+            return action;
+        }
+        planners[i].search(env.goals[i]);
+        auto path = planners[i].get_next_node(use_best_move);
+        if (path.second.first < INF)
+        {
+            const auto move = std::make_pair(path.second.first - path.first.first, path.second.second - path.first.second);
+            action = std::find(moves.begin(), moves.end(), move) - moves.begin();
+        }
+        if (use_cache)
+        {
+            plan_cache->insert(key, action);
+        }
+        return action;
+    }
+
+    std::vector<int> act()
+    {
+        TRACE_SPAN("RePlan::act");
+        std::vector<int> actions(num_agents, 0);
+        if (pool != nullptr && num_agents > 1)
+        {
+            // planners only touch their own agent's state, so they can run concurrently until the loop-fixing pass
+            pool->parallelize_loop(0, num_agents, [&](const int first, const int last)
+            {
+                for(int i = first; i < last; i++)
                 {
-                    actions.push_back(0);
+                    actions[i] = plan_agent(i);
                 }
+            }).get();
+        }
+        else
+        {
+            for(int i = 0; i < num_agents; i++)
+            {
+                actions[i] = plan_agent(i);
             }
         }
         steps++;
@@ -143,13 +150,13 @@ public:
         {
             for(int i = 0; i < num_agents; i++)
             {
-                auto path = previous_positions[i];
-                if (path.size() > 1)
+                const auto& history = previous_positions[i];
+                if (history.size() > 1)
                 {
                     auto cur_pos = env.cur_positions[i];
                     auto move = moves[actions[i]];
                     std::pair next_pos = std::make_pair(cur_pos.first + move.first, cur_pos.second + move.second);
-                    if ((path[path.size() - 1] == next_pos) || (path[path.size() - 2] == next_pos))
+                    if ((history.back() == next_pos) || (history.back(1) == next_pos))
                     {
                         if (cur_pos == next_pos)
                         {
@@ -169,12 +176,50 @@ public:
             }
         }
         env.step(actions);
+        for(int i = 0; i < num_agents; i++)
+        {
+            agents_hash.move(i, env.cur_positions[i]);
+        }
         return actions;
     }
 
+    // Plans agents concurrently on a caller-provided pool; nullptr switches back to sequential planning.
+    // The pool must not be the one executing this act(), otherwise waiting on it can deadlock.
+    void set_thread_pool(BS::thread_pool* pool_)
+    {
+        own_pool.reset();
+        pool = pool_;
+    }
+
+    // Shares planner decisions keyed by position, goal and visible agents with other RePlan instances.
+    // Cached moves were computed from another instance's obstacle knowledge, which is close enough for rollouts.
+    void set_plan_cache(PlanCache* plan_cache_)
+    {
+        plan_cache = plan_cache_;
+    }
+
+    void set_num_threads(const int num_threads)
+    {
+        if (num_threads > 1)
+        {
+            own_pool = std::make_shared<BS::thread_pool>(num_threads);
+            pool = own_pool.get();
+        }
+        else
+        {
+            set_thread_pool(nullptr);
+        }
+    }
+
     void set_env(const Environment& env_)
     {
         env = env_;
+        local_view.init(env.grid, env.get_num_agents());
+        agents_hash.init(env.grid.size(), env.grid.empty() ? 0 : env.grid[0].size(), obs_radius, env.cur_positions);
+        for(auto& p: planners)
+        {
+            p.set_bounds(env.grid.size(), env.grid.empty() ? 0 : env.grid[0].size());
+        }
     }
 };
 
@@ -184,6 +229,7 @@ PYBIND11_MODULE(replan, m) {
             .def("act", &RePlan::act)
             .def("init", &RePlan::init)
             .def("set_env", &RePlan::set_env)
+            .def("set_num_threads", &RePlan::set_num_threads)
             ;
 }
 
@@ -0,0 +1,37 @@
+#pragma once
+#include <array>
+#include <cstddef>
+
+// Fixed-capacity history that keeps only the N most recent values.
+template<typename T, size_t N>
+class RingBuffer
+{
+    std::array<T, N> data;
+    size_t head = 0;
+    size_t count = 0;
+public:
+    void push(const T& value)
+    {
+        data[head] = value;
+        head = (head + 1) % N;
+        if(count < N)
+            count++;
+    }
+
+    // k-th most recent value, back(0) is the last pushed one
+    const T& back(const size_t k = 0) const
+    {
+        return data[(head + N - 1 - k) % N];
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    void clear()
+    {
+        head = 0;
+        count = 0;
+    }
+};
@@ -0,0 +1,120 @@
+// cppimport
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mcts.cpp"
+#include <chrono>
+#include <future>
+#include <vector>
+
+namespace py = pybind11;
+
+struct EpisodeJob
+{
+    Environment env;
+    Config cfg;
+    int obs_radius = 5;
+    int seed = 0;
+    int max_episode_steps = 64;
+};
+
+struct EpisodeMetrics
+{
+    double csr = 0;
+    double isr = 0;
+    int ep_length = 0;
+    double fps = 0;
+};
+
+// Runs whole episodes with the C++ environment's step semantics, many of them at once on one pool.
+// Every episode gets its own single-threaded planner, so the pool size alone bounds the number of busy cores.
+class BatchRunner
+{
+    BS::thread_pool pool;
+public:
+    explicit BatchRunner(const int num_threads = 0) : pool(num_threads)
+    {}
+
+    static EpisodeMetrics run_episode(const EpisodeJob& job)
+    {
+        Environment env(job.env);
+        // the planner searches on this pool thread: no pondering thread, pinning or worker processes, and its own
+        // search pool is only started if the config runs parallel trees, batches or multiple simulations
+        Config cfg = job.cfg;
+        cfg.render = false;
+        cfg.ponder_expansions = 0;
+        cfg.affinity = "none";
+        cfg.num_processes = 1;
+        cfg.seed = job.seed;
+        MonteCarloTreeSearch mcts(1);
+        mcts.set_config(cfg);
+        mcts.set_env(env, job.obs_radius);
+        const auto start = std::chrono::steady_clock::now();
+        int steps(0);
+        while (!env.all_done() && steps < job.max_episode_steps)
+        {
+            env.step(mcts.act());
+            steps++;
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        EpisodeMetrics metrics;
+        int reached(0);
+        for (size_t i = 0; i < env.get_num_agents(); i++)
+        {
+            reached += env.reached_goal(i);
+        }
+        metrics.isr = env.get_num_agents() > 0 ? static_cast<double>(reached) / env.get_num_agents() : 1.0;
+        metrics.csr = env.all_done() ? 1.0 : 0.0;
+        metrics.ep_length = steps;
+        metrics.fps = seconds > 0 ? steps / seconds : 0;
+        return metrics;
+    }
+
+    std::vector<EpisodeMetrics> run(const std::vector<EpisodeJob>& jobs)
+    {
+        std::vector<std::future<EpisodeMetrics>> futures;
+        futures.reserve(jobs.size());
+        for (const auto& job: jobs)
+        {
+            futures.push_back(pool.submit([&job]{ return run_episode(job); }));
+        }
+        std::vector<EpisodeMetrics> results;
+        results.reserve(jobs.size());
+        for (auto& future: futures)
+        {
+            results.push_back(future.get());
+        }
+        return results;
+    }
+};
+
+PYBIND11_MODULE(runner, m) {
+    py::class_<EpisodeJob>(m, "EpisodeJob")
+            .def(py::init<>())
+            .def_readwrite("env", &EpisodeJob::env)
+            .def_readwrite("config", &EpisodeJob::cfg)
+            .def_readwrite("obs_radius", &EpisodeJob::obs_radius)
+            .def_readwrite("seed", &EpisodeJob::seed)
+            .def_readwrite("max_episode_steps", &EpisodeJob::max_episode_steps)
+            ;
+
+    py::class_<EpisodeMetrics>(m, "EpisodeMetrics")
+            .def(py::init<>())
+            .def_readwrite("CSR", &EpisodeMetrics::csr)
+            .def_readwrite("ISR", &EpisodeMetrics::isr)
+            .def_readwrite("ep_length", &EpisodeMetrics::ep_length)
+            .def_readwrite("FPS", &EpisodeMetrics::fps)
+            ;
+
+    py::class_<BatchRunner>(m, "BatchRunner")
+            .def(py::init<>())
+            .def(py::init<int>())
+            .def("run", &BatchRunner::run, py::call_guard<py::gil_scoped_release>())
+            ;
+}
+
+/*
+<%
+cfg['extra_compile_args'] = ['-std=c++17']
+setup_pybind11(cfg)
+%>
+*/
@@ -0,0 +1,111 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Snapshot returned by MonteCarloTreeSearch::get_stats(). Phase and wait times are summed over all threads,
+// so with several threads they can add up to more than search_seconds.
+struct SearchStats
+{
+    uint64_t expansions = 0;
+    uint64_t rollouts = 0;
+    double search_seconds = 0;
+    double expansions_per_second = 0;
+    double rollouts_per_second = 0;
+    double selection_seconds = 0;
+    double rollout_seconds = 0;
+    double backup_seconds = 0;
+    double merge_seconds = 0;
+    double insert_wait_seconds = 0;
+    double pool_wait_seconds = 0;
+    uint64_t num_nodes = 0;
+    uint64_t node_bytes = 0;
+    int max_depth = 0;
+    double avg_depth = 0;
+    // rollout_lengths[0] counts rollouts without steps, rollout_lengths[k] those of 2^(k-1) to 2^k - 1 steps
+    std::vector<uint64_t> rollout_lengths;
+};
+
+// Timestamps of the descent currently running on one search environment
+struct DescentClock
+{
+    uint64_t start = 0;
+    uint64_t leaf = 0;
+    uint64_t rollout_done = 0;
+    int depth = 0;
+};
+
+// Live counters behind SearchStats. Relaxed atomics, each touched a few times per descent or rollout.
+class SearchCounters
+{
+public:
+    static constexpr int num_length_buckets = 16;
+    std::atomic<uint64_t> search_ns{0};
+    std::atomic<uint64_t> selection_ns{0};
+    std::atomic<uint64_t> rollout_ns{0};
+    std::atomic<uint64_t> backup_ns{0};
+    std::atomic<uint64_t> merge_ns{0};
+    std::atomic<uint64_t> insert_wait_ns{0};
+    std::atomic<uint64_t> pool_wait_ns{0};
+    std::atomic<uint64_t> descents{0};
+    std::atomic<uint64_t> depth_sum{0};
+    std::atomic<int> max_depth{0};
+    std::atomic<uint64_t> rollout_lengths[num_length_buckets] = {};
+
+    static uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void add_descent(const int depth)
+    {
+        descents.fetch_add(1, std::memory_order_relaxed);
+        depth_sum.fetch_add(depth, std::memory_order_relaxed);
+        int seen = max_depth.load(std::memory_order_relaxed);
+        while (depth > seen && !max_depth.compare_exchange_weak(seen, depth, std::memory_order_relaxed))
+        {}
+    }
+
+    void add_rollout_length(const int length)
+    {
+        int bucket(0);
+        while (bucket < num_length_buckets - 1 && (length >> bucket) > 0)
+        {
+            bucket++;
+        }
+        rollout_lengths[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto* counter: {&search_ns, &selection_ns, &rollout_ns, &backup_ns, &merge_ns, &insert_wait_ns, &pool_wait_ns, &descents, &depth_sum})
+        {
+            counter->store(0);
+        }
+        max_depth = 0;
+        for (auto& bucket: rollout_lengths)
+        {
+            bucket.store(0);
+        }
+    }
+
+    void fill(SearchStats& stats) const
+    {
+        stats.search_seconds = search_ns * 1e-9;
+        stats.selection_seconds = selection_ns * 1e-9;
+        stats.rollout_seconds = rollout_ns * 1e-9;
+        stats.backup_seconds = backup_ns * 1e-9;
+        stats.merge_seconds = merge_ns * 1e-9;
+        stats.insert_wait_seconds = insert_wait_ns * 1e-9;
+        stats.pool_wait_seconds = pool_wait_ns * 1e-9;
+        stats.max_depth = max_depth;
+        stats.avg_depth = (descents > 0) ? static_cast<double>(depth_sum) / descents : 0;
+        stats.rollout_lengths.clear();
+        for (const auto& bucket: rollout_lengths)
+        {
+            stats.rollout_lengths.push_back(bucket);
+        }
+    }
+};
@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+
+// Uniform bucket grid over agent positions. Buckets are cell_size x cell_size squares, so a query with
+// radius <= cell_size touches at most 3x3 buckets and costs time proportional to the local agent density.
+class SpatialHash
+{
+    int cell_size = 1;
+    int rows = 0;
+    int cols = 0;
+    std::vector<std::vector<int>> buckets;
+    std::vector<int> agent_bucket;
+    std::vector<std::pair<int, int>> positions;
+
+    int bucket_row(const int i) const
+    {
+        return std::clamp(i / cell_size, 0, rows - 1);
+    }
+
+    int bucket_col(const int j) const
+    {
+        return std::clamp(j / cell_size, 0, cols - 1);
+    }
+public:
+    void init(const int height, const int width, const int cell_size_, const std::vector<std::pair<int, int>>& positions_)
+    {
+        cell_size = std::max(1, cell_size_);
+        rows = std::max(1, (height + cell_size - 1) / cell_size);
+        cols = std::max(1, (width + cell_size - 1) / cell_size);
+        buckets.assign(rows * cols, {});
+        positions = positions_;
+        agent_bucket.resize(positions.size());
+        for(size_t k = 0; k < positions.size(); k++)
+        {
+            agent_bucket[k] = bucket_row(positions[k].first) * cols + bucket_col(positions[k].second);
+            buckets[agent_bucket[k]].push_back(k);
+        }
+    }
+
+    void move(const int agent_idx, const std::pair<int, int> pos)
+    {
+        positions[agent_idx] = pos;
+        const int b = bucket_row(pos.first) * cols + bucket_col(pos.second);
+        if(b == agent_bucket[agent_idx])
+            return;
+        auto& old_bucket = buckets[agent_bucket[agent_idx]];
+        *std::find(old_bucket.begin(), old_bucket.end(), agent_idx) = old_bucket.back();
+        old_bucket.pop_back();
+        buckets[b].push_back(agent_idx);
+        agent_bucket[agent_idx] = b;
+    }
+
+    // Calls f(agent_idx, position) for every agent whose Chebyshev distance to pos is at most radius
+    template<typename F>
+    void for_each_within(const std::pair<int, int> pos, const int radius, F&& f) const
+    {
+        const int r0 = bucket_row(pos.first - radius), r1 = bucket_row(pos.first + radius);
+        const int c0 = bucket_col(pos.second - radius), c1 = bucket_col(pos.second + radius);
+        for(int r = r0; r <= r1; r++)
+            for(int c = c0; c <= c1; c++)
+                for(const int k: buckets[r * cols + c])
+                    if(std::abs(positions[k].first - pos.first) <= radius && std::abs(positions[k].second - pos.second) <= radius)
+                        f(k, positions[k]);
+    }
+};
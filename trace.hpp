@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Span tracing into per-thread ring buffers, dumped in the Chrome trace event format (chrome://tracing, Perfetto).
+// TRACE_SPAN compiles to nothing unless MCTS_ENABLE_TRACING is defined; with it, spans record only while
+// tracing is enabled at runtime. Each thread writes only its own buffer, which keeps its newest events.
+namespace Trace
+{
+struct Event
+{
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+class Buffer
+{
+public:
+    static constexpr uint64_t capacity = 1 << 16;
+    const int tid;
+    std::vector<Event> events;
+    std::atomic<uint64_t> head{0};
+    // first event that dump() reports, moved by clear(); only the owning thread writes head and events
+    std::atomic<uint64_t> first{0};
+
+    explicit Buffer(const int tid_) : tid(tid_), events(capacity)
+    {}
+
+    void push(const Event& event)
+    {
+        const uint64_t i = head.load(std::memory_order_relaxed);
+        events[i & (capacity - 1)] = event;
+        head.store(i + 1, std::memory_order_release);
+    }
+};
+
+struct Registry
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    // buffers of exited threads, handed to the next new thread
+    std::vector<std::shared_ptr<Buffer>> unused;
+};
+
+inline Registry& registry()
+{
+    static Registry registry;
+    return registry;
+}
+
+inline std::atomic<bool>& enabled_flag()
+{
+    static std::atomic<bool> flag(false);
+    return flag;
+}
+
+// Buffer of the calling thread. An exiting thread returns its buffer, events included, for reuse by a later
+// thread, so short-lived threads need no more buffers than ever ran at the same time.
+class LocalBuffer
+{
+public:
+    std::shared_ptr<Buffer> buffer;
+
+    LocalBuffer()
+    {
+        auto& r = registry();
+        const std::lock_guard<std::mutex> lock(r.mutex);
+        if (r.unused.empty())
+        {
+            r.buffers.push_back(std::make_shared<Buffer>(static_cast<int>(r.buffers.size())));
+            buffer = r.buffers.back();
+        }
+        else
+        {
+            buffer = r.unused.back();
+            r.unused.pop_back();
+        }
+    }
+
+    ~LocalBuffer()
+    {
+        auto& r = registry();
+        const std::lock_guard<std::mutex> lock(r.mutex);
+        r.unused.push_back(buffer);
+    }
+};
+
+inline Buffer& local_buffer()
+{
+    thread_local LocalBuffer local;
+    return *local.buffer;
+}
+
+inline uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline bool compiled()
+{
+#ifdef MCTS_ENABLE_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool enabled()
+{
+    return enabled_flag().load(std::memory_order_relaxed);
+}
+
+// returns whether spans are compiled in at all
+inline bool set_enabled(const bool enabled)
+{
+    enabled_flag() = enabled && compiled();
+    return compiled();
+}
+
+class Span
+{
+    const char* name;
+    uint64_t start;
+public:
+    explicit Span(const char* name_) : name(name_), start(enabled() ? now() : 0)
+    {}
+
+    ~Span()
+    {
+        if (start != 0)
+        {
+            local_buffer().push({name, start, now() - start});
+        }
+    }
+};
+
+// clear() and dump() may run while other threads record spans, e.g. the pondering thread
+inline void clear()
+{
+    auto& r = registry();
+    const std::lock_guard<std::mutex> lock(r.mutex);
+    for(auto& buffer: r.buffers)
+    {
+        buffer->first = buffer->head.load(std::memory_order_acquire);
+    }
+}
+
+// events of one buffer; those its thread overwrote while they were copied are dropped
+inline std::vector<Event> snapshot(const Buffer& buffer)
+{
+    const uint64_t head = buffer.head.load(std::memory_order_acquire);
+    const uint64_t begin = std::max(buffer.first.load(), head - std::min(head, Buffer::capacity));
+    std::vector<Event> events;
+    events.reserve(head - begin);
+    for(uint64_t i = begin; i < head; i++)
+    {
+        events.push_back(buffer.events[i & (Buffer::capacity - 1)]);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // index i is safe as long as the writer has not reached i + capacity, whose slot it shares
+    const uint64_t head_after = buffer.head.load(std::memory_order_relaxed);
+    const uint64_t valid = (head_after + 1 > Buffer::capacity) ? head_after + 1 - Buffer::capacity : 0;
+    if (valid > begin)
+    {
+        events.erase(events.begin(), events.begin() + std::min<uint64_t>(valid - begin, events.size()));
+    }
+    return events;
+}
+
+// writes all buffered events and returns their number, throws if the file cannot be written
+inline size_t dump(const std::string& path)
+{
+    std::vector<std::pair<int, std::vector<Event>>> buffers;
+    uint64_t origin = UINT64_MAX;
+    {
+        auto& r = registry();
+        const std::lock_guard<std::mutex> lock(r.mutex);
+        for(const auto& buffer: r.buffers)
+        {
+            buffers.emplace_back(buffer->tid, snapshot(*buffer));
+            for(const auto& event: buffers.back().second)
+            {
+                origin = std::min(origin, event.start);
+            }
+        }
+    }
+    std::ofstream out(path);
+    if (!out)
+    {
+        throw std::runtime_error("cannot open trace file " + path);
+    }
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\": [";
+    size_t written(0);
+    const int pid = getpid();
+    for(const auto& buffer: buffers)
+    {
+        for(const auto& event: buffer.second)
+        {
+            out << (written == 0 ? "\n" : ",\n") << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": " << pid
+                << ", \"tid\": " << buffer.first << ", \"ts\": " << (event.start - origin) / 1000.0
+                << ", \"dur\": " << event.duration / 1000.0 << "}";
+            written++;
+        }
+    }
+    out << "\n]}\n";
+    out.close();
+    if (!out)
+    {
+        throw std::runtime_error("cannot write trace file " + path);
+    }
+    return written;
+}
+}
+
+#ifdef MCTS_ENABLE_TRACING
+    #define TRACE_CONCAT_INNER(a, b) a##b
+    #define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+    #define TRACE_SPAN(name) Trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name)
+#else
+    #define TRACE_SPAN(name)
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// Scores all children of one node in a single pass. The parent's log term is computed once per node visit,
+// log and 1/sqrt of small visit counts come from tables, and the children's statistics are gathered into
+// contiguous arrays so that the scoring loop can be vectorized.
+class UctKernel
+{
+    static constexpr uint64_t table_size = 4096;
+
+    struct Tables
+    {
+        std::array<double, table_size> log;
+        std::array<double, table_size> inv_sqrt;
+
+        Tables()
+        {
+            log[0] = 0;
+            inv_sqrt[0] = 0;
+            for(uint64_t n = 1; n < table_size; n++)
+            {
+                log[n] = std::log(static_cast<double>(n));
+                inv_sqrt[n] = 1.0 / std::sqrt(static_cast<double>(n));
+            }
+        }
+    };
+
+    static const Tables& tables()
+    {
+        static const Tables t;
+        return t;
+    }
+public:
+    static constexpr int max_children = 8;
+
+    static double log_count(const uint64_t n)
+    {
+        return n < table_size ? tables().log[n] : std::log(static_cast<double>(n));
+    }
+
+    static double inv_sqrt_count(const uint64_t n)
+    {
+        return n < table_size ? tables().inv_sqrt[n] : 1.0 / std::sqrt(static_cast<double>(n));
+    }
+
+    // scores[k] = q[k] + c * sqrt(2 ln(parent_cnt) / cnt[k]) + bonus[k] / cnt[k], returns the index of the first maximum
+    static int best(const double* q, const uint64_t* cnt, const double* bonus, const int num, const double c, const uint64_t parent_cnt,
+                    double& best_score)
+    {
+        const double exploration = c * std::sqrt(2.0 * log_count(parent_cnt));
+        double inv_sqrt[max_children] = {}, scores[max_children] = {};
+        for(int k = 0; k < num; k++)
+            inv_sqrt[k] = inv_sqrt_count(cnt[k]);
+        for(int k = 0; k < num; k++)
+            scores[k] = q[k] + exploration * inv_sqrt[k] + bonus[k] * inv_sqrt[k] * inv_sqrt[k];
+        int best_k = 0;
+        for(int k = 1; k < num; k++)
+            if(scores[k] > scores[best_k])
+                best_k = k;
+        best_score = scores[best_k];
+        return best_k;
+    }
+
+    // PUCT: scores[k] = q[k] + c * prior[k] * sqrt(parent_cnt) / (1 + cnt[k]), cnt[k] may be 0 for unexpanded children
+    static int best_puct(const double* q, const uint64_t* cnt, const double* prior, const int num, const double c,
+                         const uint64_t parent_cnt, double& best_score)
+    {
+        const double exploration = c * std::sqrt(static_cast<double>(parent_cnt));
+        double scores[max_children] = {};
+        for(int k = 0; k < num; k++)
+            scores[k] = q[k] + exploration * prior[k] / (1 + cnt[k]);
+        int best_k = 0;
+        for(int k = 1; k < num; k++)
+            if(scores[k] > scores[best_k])
+                best_k = k;
+        best_score = scores[best_k];
+        return best_k;
+    }
+};
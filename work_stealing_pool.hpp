@@ -0,0 +1,182 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fork/join scheduler with one deque per worker. Workers pop their own tasks LIFO and steal FIFO from others,
+// and a thread waiting on a task group keeps executing queued tasks, so nested fork/join from inside a task
+// cannot starve the pool. Tasks are three pointers, nothing is allocated per spawn.
+namespace WS
+{
+class task_group
+{
+    friend class pool;
+    std::atomic<int> pending{0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+class pool
+{
+    struct task
+    {
+        void (*run)(void*);
+        void* data;
+        task_group* group;
+    };
+
+    struct task_queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    // queues[0..n-1] belong to the workers, queues[n] receives tasks spawned from outside the pool
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running{true};
+    std::atomic<int> queued{0};
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+
+    inline static thread_local const pool* current_pool = nullptr;
+    inline static thread_local int current_index = -1;
+
+    int own_queue() const
+    {
+        return current_pool == this ? current_index : static_cast<int>(threads.size());
+    }
+
+    bool pop(const int q, const bool back, task& t)
+    {
+        auto& queue = *queues[q];
+        const std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            return false;
+        if (back)
+        {
+            t = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            t = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool try_run_one()
+    {
+        const int self = own_queue();
+        const int num_queues = static_cast<int>(queues.size());
+        task t;
+        bool found = pop(self, true, t);
+        for (int k = 1; k < num_queues && !found; k++)
+        {
+            found = pop((self + k) % num_queues, false, t);
+        }
+        if (!found)
+            return false;
+        try
+        {
+            t.run(t.data);
+        }
+        catch (...)
+        {
+            const std::lock_guard<std::mutex> lock(t.group->error_mutex);
+            if (!t.group->error)
+                t.group->error = std::current_exception();
+        }
+        t.group->pending.fetch_sub(1, std::memory_order_release);
+        return true;
+    }
+
+    void worker(const int index, const std::function<void(int)>& on_start)
+    {
+        current_pool = this;
+        current_index = index;
+        if (on_start)
+            on_start(index);
+        while (running)
+        {
+            if (!try_run_one())
+            {
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                sleep_cv.wait(lock, [this]{ return queued.load() > 0 || !running; });
+            }
+        }
+    }
+
+public:
+    // on_start(index) runs first on every worker thread, e.g. to pin it to a CPU
+    explicit pool(unsigned thread_count = 0, const std::function<void(int)>& on_start = nullptr)
+    {
+        if (thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i <= thread_count; i++)
+            queues.push_back(std::make_unique<task_queue>());
+        threads.reserve(thread_count);
+        for (unsigned i = 0; i < thread_count; i++)
+            threads.emplace_back(&pool::worker, this, i, on_start);
+    }
+
+    ~pool()
+    {
+        {
+            const std::lock_guard<std::mutex> lock(sleep_mutex);
+            running = false;
+        }
+        sleep_cv.notify_all();
+        for (auto& t: threads)
+            t.join();
+    }
+
+    pool(const pool&) = delete;
+    pool& operator=(const pool&) = delete;
+
+    unsigned get_thread_count() const
+    {
+        return static_cast<unsigned>(threads.size());
+    }
+
+    // Queues f() as part of group. f is referenced, not copied, and must stay alive until wait(group) returns.
+    template<typename F>
+    void spawn(task_group& group, F& f)
+    {
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        const task t = {[](void* data){ (*static_cast<F*>(data))(); }, static_cast<void*>(&f), &group};
+        {
+            auto& queue = *queues[own_queue()];
+            const std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(t);
+        }
+        {
+            const std::lock_guard<std::mutex> lock(sleep_mutex);
+            queued.fetch_add(1, std::memory_order_relaxed);
+        }
+        sleep_cv.notify_one();
+    }
+
+    // Executes queued tasks until every task of group has finished, then rethrows the first exception it raised.
+    void wait(task_group& group)
+    {
+        while (group.pending.load(std::memory_order_acquire) > 0)
+        {
+            if (!try_run_one())
+                std::this_thread::yield();
+        }
+        if (group.error)
+            std::rethrow_exception(std::exchange(group.error, nullptr));
+    }
+};
+}
@@ -0,0 +1,415 @@
+#pragma once
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// Search worker processes for MonteCarloTreeSearch. Workers are started with fork+exec, so they never inherit
+// the threads or locks of the coordinator, and live until the coordinator drops them. Job and result payloads
+// go through a shared memory file (fd 3 in the worker); a socket (fd 4) carries the notices that a payload is
+// ready and lets either side see the other one exit.
+namespace Workers
+{
+constexpr int segment_fd = 3;
+constexpr int socket_fd = 4;
+// set in the environment of workers started from an executable, see MonteCarloTreeSearch::serve_if_worker()
+constexpr const char* native_variable = "MCTS_SEARCH_WORKER";
+
+struct Notice
+{
+    uint64_t job;
+    uint64_t bytes;
+};
+
+inline uint64_t now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline std::string own_executable()
+{
+    char path[PATH_MAX];
+    return (realpath("/proc/self/exe", path) == nullptr) ? "" : path;
+}
+
+// binary or shared library this code was linked into
+inline std::string own_image()
+{
+    Dl_info info;
+    char path[PATH_MAX];
+    if (dladdr(reinterpret_cast<void*>(&own_image), &info) == 0 || info.dli_fname == nullptr || realpath(info.dli_fname, path) == nullptr)
+    {
+        // the main program may be reported without a usable name
+        return own_executable();
+    }
+    return path;
+}
+
+inline bool write_all(const int fd, const char* data, size_t bytes, off_t offset)
+{
+    while (bytes > 0)
+    {
+        const ssize_t written = pwrite(fd, data, bytes, offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        bytes -= written;
+        offset += written;
+    }
+    return true;
+}
+
+inline bool read_all(const int fd, char* data, size_t bytes, off_t offset)
+{
+    while (bytes > 0)
+    {
+        const ssize_t read = pread(fd, data, bytes, offset);
+        if (read < 0 && errno == EINTR)
+            continue;
+        if (read <= 0)
+            return false;
+        data += read;
+        bytes -= read;
+        offset += read;
+    }
+    return true;
+}
+
+inline bool send_notice(const int fd, const Notice& notice)
+{
+    ssize_t sent;
+    do
+    {
+        sent = send(fd, &notice, sizeof(notice), MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == static_cast<ssize_t>(sizeof(notice));
+}
+
+// waits up to timeout_ms (-1 without limit); false on timeout, error or when the other side is gone
+inline bool receive_notice(const int fd, Notice& notice, const int timeout_ms)
+{
+    pollfd p = {fd, POLLIN, 0};
+    int ready;
+    do
+    {
+        ready = poll(&p, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0)
+        return false;
+    ssize_t received;
+    do
+    {
+        received = recv(fd, &notice, sizeof(notice), MSG_WAITALL);
+    } while (received < 0 && errno == EINTR);
+    return received == static_cast<ssize_t>(sizeof(notice));
+}
+
+// Flat payloads of trivially copyable values and vectors of them
+class Writer
+{
+public:
+    std::string data;
+
+    template<typename T>
+    void put(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    void put(const std::vector<T>& values)
+    {
+        put<uint64_t>(values.size());
+        for(const auto& value: values)
+            put(value);
+    }
+
+    void put(const std::string& text)
+    {
+        put<uint64_t>(text.size());
+        data += text;
+    }
+};
+
+class Reader
+{
+    const std::string& data;
+    size_t offset = 0;
+public:
+    explicit Reader(const std::string& data_) : data(data_) {}
+
+    template<typename T>
+    void get(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (offset + sizeof(T) > data.size())
+            throw std::runtime_error("truncated worker payload");
+        std::memcpy(&value, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+    }
+
+    template<typename T>
+    void get(std::vector<T>& values)
+    {
+        uint64_t size(0);
+        get(size);
+        values.resize(size);
+        for(auto& value: values)
+            get(value);
+    }
+
+    void get(std::string& text)
+    {
+        uint64_t size(0);
+        get(size);
+        if (offset + size > data.size())
+            throw std::runtime_error("truncated worker payload");
+        text = data.substr(offset, size);
+        offset += size;
+    }
+};
+
+// Coordinator side of one worker
+class Process
+{
+    pid_t pid = -1;
+    int segment = -1;
+    int socket = -1;
+    bool ready = false;
+    uint64_t request_bytes = 0;
+    int failed_starts = 0;
+public:
+    // workers that die before they report ready this often in a row are not started again
+    static constexpr int max_failed_starts = 3;
+
+    Process() = default;
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+
+    ~Process()
+    {
+        stop();
+    }
+
+    bool running() const
+    {
+        return pid > 0;
+    }
+
+    bool disabled() const
+    {
+        return failed_starts >= max_failed_starts;
+    }
+
+    bool start()
+    {
+        const std::string image = own_image();
+        const std::string executable = own_executable();
+        if (image.empty() || executable.empty())
+        {
+            failed_starts = max_failed_starts;
+            return false;
+        }
+        // an executable restarts itself as a worker, a Python extension makes the interpreter load it again
+        std::vector<std::string> args = {executable};
+        std::vector<std::string> variables;
+        for(char** v = environ; *v != nullptr; v++)
+        {
+            if (std::strncmp(*v, native_variable, std::strlen(native_variable)) != 0)
+                variables.push_back(*v);
+        }
+        if (image == executable)
+        {
+            variables.push_back(std::string(native_variable) + "=1");
+        }
+        else
+        {
+            args.push_back("-c");
+            args.push_back("import sys, importlib.util as u; s = u.spec_from_file_location('mcts', sys.argv[1]); "
+                           "m = u.module_from_spec(s); s.loader.exec_module(m); m._serve_worker()");
+            args.push_back(image);
+        }
+        std::vector<char*> argv, envp;
+        for(auto& arg: args)
+            argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        for(auto& variable: variables)
+            envp.push_back(&variable[0]);
+        envp.push_back(nullptr);
+
+        int pair[2];
+        const int memory = memfd_create("mcts-worker", MFD_CLOEXEC);
+        if (memory < 0 || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0)
+        {
+            if (memory >= 0)
+                close(memory);
+            failed_starts++;
+            return false;
+        }
+        // above the descriptors the worker gets, so that neither dup2() in the child overwrites the other source
+        const int child_segment = fcntl(memory, F_DUPFD_CLOEXEC, 10);
+        const int child_socket = fcntl(pair[1], F_DUPFD_CLOEXEC, 10);
+        close(pair[1]);
+        const pid_t child = (child_segment >= 0 && child_socket >= 0) ? fork() : -1;
+        if (child == 0)
+        {
+            // only async-signal-safe calls until exec
+            if (dup2(child_segment, segment_fd) < 0 || dup2(child_socket, socket_fd) < 0)
+                _exit(127);
+            execve(argv[0], argv.data(), envp.data());
+            _exit(127);
+        }
+        for(const int fd: {child_segment, child_socket})
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+        if (child < 0)
+        {
+            close(memory);
+            close(pair[0]);
+            failed_starts++;
+            return false;
+        }
+        pid = child;
+        segment = memory;
+        socket = pair[0];
+        ready = false;
+        return true;
+    }
+
+    // waits until the worker reported ready or deadline_ms passed; a worker that died meanwhile is reaped
+    bool wait_ready(const uint64_t deadline_ms)
+    {
+        if (ready || !running())
+            return ready;
+        const uint64_t now = now_ms();
+        Notice notice;
+        if (receive_notice(socket, notice, (deadline_ms > now) ? static_cast<int>(deadline_ms - now) : 0))
+        {
+            ready = true;
+            failed_starts = 0;
+            return true;
+        }
+        pollfd p = {socket, POLLIN, 0};
+        if (poll(&p, 1, 0) > 0 || waitpid(pid, nullptr, WNOHANG) != 0)
+        {
+            kill();
+            failed_starts++;
+        }
+        return false;
+    }
+
+    bool post(const uint64_t job, const std::string& payload)
+    {
+        request_bytes = payload.size();
+        if (!write_all(segment, payload.data(), payload.size(), 0) || !send_notice(socket, {job, payload.size()}))
+        {
+            kill();
+            return false;
+        }
+        return true;
+    }
+
+    // result of job if it arrives before deadline_ms; otherwise the worker is killed, start() brings up a new one
+    bool collect(const uint64_t job, const uint64_t deadline_ms, std::string& payload)
+    {
+        Notice notice;
+        while (running())
+        {
+            const uint64_t now = now_ms();
+            if (!receive_notice(socket, notice, (deadline_ms > now) ? static_cast<int>(deadline_ms - now) : 0))
+                break;
+            if (notice.job != job)
+                continue;
+            payload.resize(notice.bytes);
+            if (!read_all(segment, &payload[0], notice.bytes, request_bytes))
+                break;
+            return true;
+        }
+        kill();
+        return false;
+    }
+
+    void kill()
+    {
+        if (pid > 0)
+        {
+            ::kill(pid, SIGKILL);
+            while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR)
+            {}
+        }
+        close_descriptors();
+    }
+
+    // an idle worker exits when its socket closes, a busy one is killed after a short grace period
+    void stop()
+    {
+        if (socket >= 0)
+        {
+            shutdown(socket, SHUT_RDWR);
+        }
+        for(int i = 0; i < 20 && pid > 0; i++)
+        {
+            if (waitpid(pid, nullptr, WNOHANG) == pid)
+            {
+                pid = -1;
+                break;
+            }
+            usleep(5000);
+        }
+        kill();
+    }
+
+private:
+    void close_descriptors()
+    {
+        for(int* fd: {&segment, &socket})
+        {
+            if (*fd >= 0)
+                close(*fd);
+            *fd = -1;
+        }
+        pid = -1;
+        ready = false;
+    }
+};
+
+// Worker side: serve(respond) answers jobs until the coordinator goes away
+template<typename F>
+void serve(F&& respond)
+{
+    if (!send_notice(socket_fd, {0, 0}))
+        return;
+    Notice notice;
+    std::string request;
+    while (receive_notice(socket_fd, notice, -1))
+    {
+        request.resize(notice.bytes);
+        if (!read_all(segment_fd, &request[0], notice.bytes, 0))
+            return;
+        const std::string result = respond(request);
+        if (!write_all(segment_fd, result.data(), result.size(), notice.bytes) || !send_notice(socket_fd, {notice.job, result.size()}))
+            return;
+    }
+}
+}